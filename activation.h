@@ -0,0 +1,80 @@
+/**
+ * Activation functions shared by the fused neuron operation, the tensor path and the network layers.
+ */
+#include <cmath>
+#include <cstddef>
+#include <string>
+#pragma once
+#include "simd.h"
+
+enum class Activation
+{
+    Tanh,
+    Sigmoid,
+    ReLU,
+};
+
+inline std::string activation_name(Activation activation)
+{
+    switch (activation)
+    {
+    case Activation::Tanh:
+        return "tanh";
+    case Activation::Sigmoid:
+        return "sigmoid";
+    case Activation::ReLU:
+        return "relu";
+    }
+    return "unknown";
+}
+
+// y = f(x), stable for any finite x
+inline float activate(Activation activation, float x)
+{
+    switch (activation)
+    {
+    case Activation::Tanh:
+        return simd::tanh_stable(x);
+    case Activation::Sigmoid:
+    {
+        // only ever exponentiate a non-positive number, so exp can't overflow
+        float e = std::exp(-std::fabs(x));
+        return x >= 0 ? 1.0f / (1.0f + e) : e / (1.0f + e);
+    }
+    case Activation::ReLU:
+        return x > 0.0f ? x : 0.0f;
+    }
+    return x;
+}
+
+// dy/dx expressed in terms of the output y = f(x), so backward never has to redo any transcendental math
+inline float activation_derivative(Activation activation, float y)
+{
+    switch (activation)
+    {
+    case Activation::Tanh:
+        return 1.0f - y * y;
+    case Activation::Sigmoid:
+        return y * (1.0f - y);
+    case Activation::ReLU:
+        return y > 0.0f ? 1.0f : 0.0f;
+    }
+    return 1.0f;
+}
+
+// out[i] = f(in[i]) over a whole buffer, vectorized
+inline void activate(Activation activation, const float *in, float *out, size_t n)
+{
+    switch (activation)
+    {
+    case Activation::Tanh:
+        simd::tanh(in, out, n);
+        return;
+    case Activation::Sigmoid:
+        simd::sigmoid(in, out, n);
+        return;
+    case Activation::ReLU:
+        simd::relu(in, out, n);
+        return;
+    }
+}
@@ -0,0 +1,131 @@
+/**
+ * Bump allocator for the nodes of a single training step's computation graph.
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "arena.h"
+
+static thread_local GraphArena *current_arena = nullptr;
+
+// arenas with a label id, by id. Slot 0 is never used, id 0 stands for the shared label table.
+static std::array<std::atomic<GraphArena *>, 256> label_tables{};
+
+GraphArena::GraphArena(size_t block_size) : block_size(block_size)
+{
+    for (uint8_t id = 1; id != 0 && label_id == 0; id++)
+    {
+        GraphArena *expected = nullptr;
+        if (label_tables[id].compare_exchange_strong(expected, this, std::memory_order_acq_rel))
+        {
+            label_id = id;
+        }
+    }
+}
+
+GraphArena::~GraphArena()
+{
+    if (label_id != 0)
+    {
+        label_tables[label_id].store(nullptr, std::memory_order_release);
+    }
+}
+
+GraphArena *GraphArena::current()
+{
+    return current_arena;
+}
+
+GraphArena *GraphArena::from_label_id(uint8_t id)
+{
+    return label_tables[id].load(std::memory_order_acquire);
+}
+
+bool GraphArena::owns(const void *p) const
+{
+    auto address = reinterpret_cast<uintptr_t>(p);
+    for (const auto &block : blocks)
+    {
+        auto base = reinterpret_cast<uintptr_t>(block.memory.get());
+        if (address >= base && address < base + block.size)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t GraphArena::bytes_reserved() const
+{
+    size_t total = 0;
+    for (const auto &block : blocks)
+    {
+        total += block.size;
+    }
+    return total;
+}
+
+void GraphArena::reset()
+{
+    if (live != 0)
+    {
+        throw std::runtime_error("GraphArena::reset() called while " + std::to_string(live) + " allocations are still alive, drop all graph handles from this step first");
+    }
+    current_block = 0;
+    offset = 0;
+    used_in_previous_blocks = 0;
+    label_table.clear(); // already empty, every labeled node erased its entry
+}
+
+void *GraphArena::do_allocate(size_t bytes, size_t alignment)
+{
+    while (true)
+    {
+        if (current_block == blocks.size())
+        {
+            // out of blocks, grab a new one that is big enough for this request
+            size_t new_size = std::max(block_size, bytes + alignment);
+            blocks.push_back(Block{std::make_unique<std::byte[]>(new_size), new_size});
+        }
+
+        auto &block = blocks[current_block];
+        auto base = reinterpret_cast<uintptr_t>(block.memory.get());
+        size_t aligned = ((base + offset + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1)) - base;
+        if (aligned + bytes <= block.size)
+        {
+            offset = aligned + bytes;
+            live++;
+            high_water = std::max(high_water, bytes_used());
+            return block.memory.get() + aligned;
+        }
+
+        // doesn't fit, the rest of this block is left unused until the next reset
+        used_in_previous_blocks += block.size;
+        current_block++;
+        offset = 0;
+    }
+}
+
+void GraphArena::do_deallocate(void *, size_t, size_t)
+{
+    // memory is only reclaimed in bulk by reset()
+    live--;
+}
+
+bool GraphArena::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
+
+ArenaScope::ArenaScope(GraphArena &arena) : previous(current_arena)
+{
+    current_arena = &arena;
+}
+
+ArenaScope::~ArenaScope()
+{
+    current_arena = previous;
+}
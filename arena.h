@@ -0,0 +1,103 @@
+/**
+ * Bump allocator for the nodes of a single training step's computation graph.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#pragma once
+
+class Value;
+
+/**
+ * A GraphArena hands out memory by bumping an offset through a few large blocks, and never frees anything individually.
+ * Once every node of a step's graph has been dropped, reset() rewinds the offset so the next step reuses the same blocks.
+ *
+ * It is a std::pmr::memory_resource, so both the Value nodes (with their shared_ptr control blocks) and their `prev`
+ * operand lists can be allocated from it. Nodes are routed into it by an ArenaScope, see below.
+ *
+ * Not thread safe: each thread should use its own arena. That also makes the arena the place for the labels of its nodes
+ * (see Value::set_label): they are kept in a table of the arena, without the lock of the shared table.
+ */
+class GraphArena : public std::pmr::memory_resource
+{
+public:
+    explicit GraphArena(size_t block_size = 1 << 20);
+    ~GraphArena() override;
+    GraphArena(const GraphArena &) = delete;
+    GraphArena &operator=(const GraphArena &) = delete;
+
+    // rewind to the start of the first block, keeping all blocks for reuse.
+    // throws if anything allocated from the arena is still alive, since its memory is about to be handed out again
+    void reset();
+
+    size_t bytes_used() const { return used_in_previous_blocks + offset; } // bytes handed out since the last reset
+    size_t high_water_mark() const { return high_water; }                 // most bytes ever in use between two resets
+    size_t bytes_reserved() const;                                          // total size of all blocks
+    size_t block_count() const { return blocks.size(); }
+    size_t live_allocations() const { return live; }
+
+    // the arena new graph nodes are allocated from on this thread, or nullptr for the regular heap
+    static GraphArena *current();
+
+    // whether p points into memory handed out by this arena
+    bool owns(const void *p) const;
+
+private:
+    friend class ArenaScope;
+    friend class Value; // keeps its label in label_table
+
+    // the first 255 arenas alive get an id, so a node can find its arena's label table from one byte. Nodes of an arena
+    // without one keep their labels in the shared table.
+    static GraphArena *from_label_id(uint8_t id);
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+    struct Block
+    {
+        std::unique_ptr<std::byte[]> memory;
+        size_t size;
+    };
+
+    size_t block_size;
+    std::vector<Block> blocks;
+    size_t current_block = 0;           // index of the block we are bumping through
+    size_t offset = 0;                  // bytes used in the current block
+    size_t used_in_previous_blocks = 0; // bytes used (including padding left at the end) in blocks before the current one
+    size_t high_water = 0;
+    size_t live = 0; // allocations not yet deallocated, used to catch nodes that outlive a reset
+    uint8_t label_id = 0; // 0 if all ids were taken
+    std::unordered_map<const Value *, std::string> label_table;
+};
+
+/**
+ * RAII guard that routes every graph node created on this thread into `arena` while it is alive, e.g.
+ *
+ *     GraphArena arena;
+ *     for (...) {
+ *         {
+ *             ArenaScope scope(arena);
+ *             auto loss = ...;
+ *             loss->backward();
+ *         } // all graph handles dropped here
+ *         arena.reset();
+ *     }
+ *
+ * Scopes nest; the previous arena (or the heap) is restored on destruction.
+ */
+class ArenaScope
+{
+public:
+    explicit ArenaScope(GraphArena &arena);
+    ~ArenaScope();
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    GraphArena *previous;
+};
@@ -2,10 +2,15 @@
  * Custom implementation of automatic differentiation on scalar-valued functions, just for fun and learning.
  */
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include "autograd.h"
+#include "arena.h"
+#include "tape.h"
 #include "network.h"
 #include "operation.h"
 #include "constants.h"
+#include "profiler.h"
 
 std::ostream &operator<<(std::ostream &os, const Operation &op){
    os << op.get_name();
@@ -34,60 +39,110 @@ std::ostream &operator<<(std::ostream &os, const std::shared_ptr<Value> &v)
  */
 std::shared_ptr<Value> make_value(float x, const std::optional<std::string>& label)
 {
+    if (auto *arena = GraphArena::current())
+    {
+        return std::allocate_shared<Value>(std::pmr::polymorphic_allocator<Value>(arena), x, label);
+    }
     return std::make_shared<Value>(x, label);
 }
 
+std::shared_ptr<Value> make_constant(float x)
+{
+    auto v = make_value(x);
+    v->set_constant(true);
+    return v;
+}
 
+std::shared_ptr<Value> make_parameter(float x, const std::optional<std::string>& label)
+{
+    return std::make_shared<Value>(x, label);
+}
 
+std::shared_ptr<Value> make_node(float data, std::span<const std::shared_ptr<Value>> prev, const std::shared_ptr<const Operation>& op)
+{
+    std::shared_ptr<Value> node;
+    if (auto *arena = GraphArena::current())
+    {
+        // one bump allocation for the node + control block, and one for its operand list
+        node = std::allocate_shared<Value>(std::pmr::polymorphic_allocator<Value>(arena), data, prev, op, arena);
+    }
+    else
+    {
+        node = std::make_shared<Value>(data, prev, op, std::pmr::get_default_resource());
+    }
 
+    if (auto *tape = Tape::current())
+    {
+        tape->record(node);
+    }
+    return node;
+}
 
 
-network_output_t topo_sort(const std::shared_ptr<Value> out){
 
-    // top-sort with cycle detection, where the first node has no ancestors while the last node has the most ancestors
-    std::unordered_map<std::shared_ptr<Value>, int> in_degree;
 
-    // count the in-degrees of each node using dfs
-    std::function<void(const std::shared_ptr<Value>&)> dfs_count =
-        [&](const std::shared_ptr<Value>& v) {
-            if (!v) return;
 
-            if (in_degree.count(v)) return; // already visited
 
-            in_degree[v] = 0; // initialize in-degree
+uint64_t new_traversal_epoch()
+{
+    static std::atomic<uint64_t> last_epoch{0}; // nodes start at epoch 0, so 0 is never handed out
+    return last_epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+}
 
-            for (const auto& p : v->get_prev()) {
-                dfs_count(p);
-                in_degree[p]++; // count incoming edge
-            }
-        };
+network_output_t topo_sort(const std::shared_ptr<Value> out){
+    return topo_sort(std::span<const std::shared_ptr<Value>>(&out, 1));
+}
 
-    dfs_count(out);
+network_output_t topo_sort(std::span<const std::shared_ptr<Value>> outs){
+    ProfileScope profile("sort", "phase");
 
-    network_output_t sorted;
-    sorted.reserve(in_degree.size());
-    size_t cur_index = 0;
+    // Kahn's algorithm: count how many users each node has, then emit a node once all of its users have been emitted.
+    // The visit stamp and in-degree live in the nodes, and the walk uses an explicit stack, so there is no hashing and
+    // no recursion however deep the graph.
+    uint64_t epoch = new_traversal_epoch();
+    size_t n_nodes = 0;
+    std::vector<Value*> stack;
+    for (const auto& out : outs) {
+        if (out->mark_visited(epoch)) {
+            stack.push_back(out.get());
+            n_nodes++;
+        }
+    }
+    while (!stack.empty()) {
+        Value* v = stack.back();
+        stack.pop_back();
+        for (const auto& p : v->get_prev()) {
+            if (p->mark_visited(epoch)) {
+                stack.push_back(p.get());
+                n_nodes++;
+            }
+            p->traversal_counter()++; // count incoming edge
+        }
+    }
 
-    for (const auto& [ptr, val] : in_degree) {
-        if (val == 0) { // get in-degree 0 nodes
-           sorted.push_back(ptr);
+    network_output_t sorted;
+    sorted.reserve(n_nodes);
+    for (const auto& out : outs) {
+        if (out->traversal_counter() == 0) { // out has no users, unless it is part of a cycle
+            sorted.push_back(out);
+            out->traversal_counter() = 1; // nothing decrements it, and an out listed twice only goes in once
         }
     }
+    size_t cur_index = 0;
 
     while (cur_index < sorted.size()) { // keep going while we have nodes left to process in the topological order
-        auto v = sorted[cur_index++];
+        Value* v = sorted[cur_index++].get();
 
         // relax the child edges
         for (const auto& p : v->get_prev()) {
-            in_degree[p]--;
-            if (in_degree[p] == 0) {
+            if (--p->traversal_counter() == 0) {
                 sorted.push_back(p);
             }
         }
     }
 
-    if (sorted.size() != in_degree.size()) {
-        throw std::runtime_error("Cycle detected in computation graph during topological sort, sorted.size: " + std::to_string(sorted.size()) + ", in_degree.size(): " + std::to_string(in_degree.size()) + ")");
+    if (sorted.size() != n_nodes) {
+        throw std::runtime_error("Cycle detected in computation graph during topological sort, sorted.size: " + std::to_string(sorted.size()) + ", nodes: " + std::to_string(n_nodes) + ")");
     }
 
     
@@ -98,13 +153,139 @@ network_output_t topo_sort(const std::shared_ptr<Value> out){
     }
     );
 
+    profile.add_nodes(sorted.size());
     return sorted;
 }
 
-void Value::backward()
+// labels of the nodes that have one (Value::labeled). A node allocated from a GraphArena keeps its label in that
+// arena's table, which only the arena's thread uses, so without a lock. Every other node (parameters, graphs built on
+// the heap) uses this table, shared by all threads. Never destroyed, since Values in static storage may outlive it
+// otherwise.
+namespace
 {
+std::atomic<bool> record_labels{DRAW_GRAPHS || DEBUG};
+std::mutex label_mutex;
+auto &label_table = *new std::unordered_map<const Value *, std::string>;
+} // namespace
+
+void set_record_labels(bool record)
+{
+    record_labels.store(record, std::memory_order_relaxed);
+}
+
+bool recording_labels()
+{
+    return record_labels.load(std::memory_order_relaxed);
+}
+
+std::optional<std::string> Value::get_label() const
+{
+    if (!labeled)
+    {
+        return std::nullopt;
+    }
+    if (label_arena != 0)
+    {
+        return GraphArena::from_label_id(label_arena)->label_table.at(this);
+    }
+    std::lock_guard<std::mutex> lock(label_mutex);
+    return label_table.at(this);
+}
+
+void Value::set_label(const std::optional<std::string> &new_label)
+{
+    if (!new_label.has_value() || !recording_labels())
+    {
+        return;
+    }
+    if (!labeled)
+    {
+        // a node labeled while the arena it lives in is current (e.g. right after it was built) goes in that arena
+        auto *arena = GraphArena::current();
+        if (arena != nullptr && arena->owns(this))
+        {
+            label_arena = arena->label_id;
+        }
+    }
+    if (label_arena != 0)
+    {
+        GraphArena::from_label_id(label_arena)->label_table[this] = *new_label;
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(label_mutex);
+        label_table[this] = *new_label;
+    }
+    labeled = true;
+}
+
+// set while a ~Value is freeing a graph: nested destructors hand their operands to it instead of destroying them
+static thread_local std::vector<std::shared_ptr<Value>> *pending_release = nullptr;
+
+Value::~Value()
+{
+    if (labeled && label_arena != 0)
+    {
+        GraphArena::from_label_id(label_arena)->label_table.erase(this);
+    }
+    else if (labeled)
+    {
+        std::lock_guard<std::mutex> lock(label_mutex);
+        label_table.erase(this);
+    }
+    if (prev.empty())
+    {
+        return;
+    }
+    // destroying prev normally would destroy operands that only this node owns, which destroy theirs, and so on: one
+    // set of stack frames per node along a chain. Instead, operands we own alone are queued, and the outermost
+    // destructor frees the queue one node at a time. Operands held elsewhere just lose a reference.
+    auto hand_over = [this](std::vector<std::shared_ptr<Value>> &queue) {
+        for (auto &p : prev)
+        {
+            if (p.use_count() == 1)
+            {
+                queue.push_back(std::move(p));
+            }
+        }
+    };
+    if (pending_release != nullptr)
+    {
+        hand_over(*pending_release);
+        return;
+    }
+    std::vector<std::shared_ptr<Value>> queue;
+    hand_over(queue);
+    if (queue.empty())
+    {
+        return;
+    }
+    pending_release = &queue;
+    while (!queue.empty())
+    {
+        auto node = std::move(queue.back());
+        queue.pop_back();
+        node.reset(); // its destructor appends its own operands to the queue
+    }
+    pending_release = nullptr;
+}
+
+void Value::backward(bool retain_graph)
+{
+    ProfileScope profile("backward", "phase");
+    // if this graph was recorded, creation order already gives us the topological order
+    if (auto *tape = Tape::current())
+    {
+        if (size_t n_nodes = tape->backward(*this, retain_graph); n_nodes > 0)
+        {
+            profile.add_nodes(n_nodes);
+            return;
+        }
+    }
+
     // topological sort the computation graph starting from this node
     auto sorted = topo_sort(shared_from_this());
+    profile.add_nodes(sorted.size());
 
     // set the gradient of this node w.r.t itself to be 1.0
     this->set_grad(1.0f);
@@ -112,15 +293,18 @@ void Value::backward()
     // traverse in topological order to propagate gradients from end to start of comp graph 
     // we do it top-down because if y = f(g(x)) , then dy/dx = dy/dg * dg/dx, so we need to know dy/dg before we can compute dy/dx
     for (auto it = sorted.begin(); it != sorted.end(); ++it) {
-        auto v = *it;
-        auto op = v->get_operation();
+        auto &v = *it;
+        const auto &op = v->get_operation();
         DBG(
         std::cout << "Backpropagating through Value node with data=" << v->get_data() << ", grad=" << v->get_grad() << ", operation=" << (op != nullptr ? op->get_name() : "nullopt") << "\n";
         );
         if (op != nullptr) {
-            // make span of prev
-            auto prev_span = std::span<std::shared_ptr<Value> const>(v->get_prev().data(), v->get_prev().size());
-            op->backward(prev_span, v);
+            backward_node(*v);
+        }
+        if (!retain_graph) {
+            // every user of v came before it, so nothing needs v's operands anymore, and v itself goes unless held elsewhere
+            v->release_operands();
+            v.reset();
         }
     }
 
@@ -3,11 +3,15 @@
  *
  * For autograd, we approximate deirvatives using finite differences.
  */
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory_resource>
 #include <optional>
 #include <span>
 #pragma once
 #include "operation.h"
+#include "operand_list.h"
 
 template <class T>
 void print(const T &x)
@@ -17,6 +21,28 @@ void print(const T &x)
 
 
 
+// counts the Value objects alive in the process, and the most alive at once (see live_values() in graph_stats.h)
+struct LiveValueCounter
+{
+    LiveValueCounter() noexcept
+    {
+        size_t now = live.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t current_peak = peak.load(std::memory_order_relaxed);
+        while (now > current_peak && !peak.compare_exchange_weak(current_peak, now, std::memory_order_relaxed))
+        {
+        }
+    }
+    ~LiveValueCounter()
+    {
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+    LiveValueCounter(const LiveValueCounter &) = delete;
+    LiveValueCounter &operator=(const LiveValueCounter &) = delete;
+
+    static inline std::atomic<size_t> live{0};
+    static inline std::atomic<size_t> peak{0};
+};
+
 /**
 * A Value represents a scalar value in the computation graph, along with its gradient and dependencies.
 *
@@ -26,7 +52,11 @@ void print(const T &x)
 *  - grad: the gradient of some final output w.r.t this value (computed during backpropagation)
 *  - prev: the input Values that were used to compute this Value (if any)
 *  - op: the Operation that produced this Value (if any)
-*  - label: optional human-readable label for debugging/visualization
+*  - label: optional human-readable label for debugging/visualization, kept in a side table (see set_record_labels)
+*
+* Nodes are laid out to fit in two cache lines together with their shared_ptr control block: the operands of scalar
+* ops are stored inline (see OperandList), and longer operand lists are allocated from the same memory resource as the
+* node, so nodes created inside an ArenaScope keep them in the same GraphArena (see arena.h and make_node below).
 *
 * The Value class provides methods to get/set these fields, and to perform backpropagation
 * to compute gradients w.r.t all input Values in the computation graph.
@@ -35,28 +65,37 @@ class Value : public std::enable_shared_from_this<Value>
 {
 public:
 
-    Value(float data, const std::optional<std::string>& label) : data(data), label(label) {}
-    Value(float data, const std::vector<std::shared_ptr<Value>> &prev, const std::shared_ptr<const Operation> op) : data(data), prev(prev), op(op){}
-    Value(float data, const std::vector<std::shared_ptr<Value>> &prev, const std::shared_ptr<const Operation> op, const std::optional<std::string>& label) : data(data), prev(prev), op(op), label(label) {}
+    Value(float data, const std::optional<std::string>& label) : data(data) { set_label(label); }
+    Value(float data, const std::vector<std::shared_ptr<Value>> &prev, const std::shared_ptr<const Operation> op) : data(data), prev(prev, std::pmr::get_default_resource()), op(op), op_kind(kind_of(op)) {}
+    Value(float data, const std::vector<std::shared_ptr<Value>> &prev, const std::shared_ptr<const Operation> op, const std::optional<std::string>& label) : Value(data, prev, op) { set_label(label); }
+    Value(float data, std::span<const std::shared_ptr<Value>> prev, const std::shared_ptr<const Operation> op, std::pmr::memory_resource* resource) : data(data), prev(prev, resource), op(op), op_kind(kind_of(op)) {}
+
+    // parameter nodes may keep their data and grad in a ParameterStore, so every access goes through data_ptr/grad_ptr
+    Value(const Value &) = delete;
+    Value &operator=(const Value &) = delete;
+
+    // frees the operands only this node kept alive without recursing, so even very long chains take constant stack
+    ~Value();
 
     float get_data() const
     {
-        return data;
+        return *data_ptr;
     }
 
-    const std::optional<std::string>& get_label() const
-    {
-        return label;
-    }
-    void set_label(const std::string& new_label)
-    {
-        label = new_label;
-    }
+    // a copy of the label from the side table, nullopt if the node has none
+    std::optional<std::string> get_label() const;
+    // does nothing unless labels are being recorded (see set_record_labels), so graphs don't pay for them by default
+    void set_label(const std::optional<std::string>& new_label);
 
-    const std::vector<std::shared_ptr<Value>> &get_prev() const
+    const OperandList &get_prev() const
     {
         return prev;
     }
+    // op->kind(), kept in the node so backward_node can dispatch without loading the operation (Custom for leaves)
+    OpKind get_op_kind() const
+    {
+        return op_kind;
+    }
     const std::shared_ptr<const Operation> &get_operation() const
     {
         return op;
@@ -64,12 +103,12 @@ public:
 
     float get_grad() const
     {
-        return grad;
+        return *grad_ptr;
     }
 
     void set_grad(float new_grad)
     {
-        grad = new_grad;
+        *grad_ptr = new_grad;
     }
 
     void add_grad(float grad_increment)
@@ -77,14 +116,105 @@ public:
         this->set_grad(this->get_grad() + grad_increment);
     }
 
+    // same as add_grad, but safe when several threads accumulate into the same node (e.g. a shared weight)
+    void atomic_add_grad(float grad_increment)
+    {
+        std::atomic_ref<float>(*grad_ptr).fetch_add(grad_increment, std::memory_order_relaxed);
+    }
+
     void set_data(float new_data)
     {
-        data = new_data;
+        *data_ptr = new_data;
+    }
+
+    // relaxed atomic access to data, for parameters that other threads update in place (see Hogwild in parallel.h)
+    float atomic_get_data() const
+    {
+        return std::atomic_ref<float>(*data_ptr).load(std::memory_order_relaxed);
+    }
+    void atomic_set_data(float new_data)
+    {
+        std::atomic_ref<float>(*data_ptr).store(new_data, std::memory_order_relaxed);
+    }
+    void atomic_add_data(float data_increment)
+    {
+        std::atomic_ref<float>(*data_ptr).fetch_add(data_increment, std::memory_order_relaxed);
+    }
+
+    // where data and grad currently live: the node's own fields, or its slots in a ParameterStore
+    float *data_storage() const
+    {
+        return data_ptr;
+    }
+    float *grad_storage() const
+    {
+        return grad_ptr;
+    }
+    // move data and grad into external slots (the current values are copied over), or back into the node's own fields
+    void bind_storage(float *data_slot, float *grad_slot)
+    {
+        *data_slot = *data_ptr;
+        *grad_slot = *grad_ptr;
+        data_ptr = data_slot;
+        grad_ptr = grad_slot;
+    }
+    void unbind_storage()
+    {
+        bind_storage(&data, &grad);
+    }
+
+    // constants are leaves created from plain floats (e.g. the 2 in `2 * x`), which graph passes may fold or deduplicate
+    bool is_constant() const
+    {
+        return constant;
+    }
+    void set_constant(bool is_constant)
+    {
+        constant = is_constant;
     }
 
     // propagate gradients through all dependent nodes (in topological order) to compute gradients w.r.t this value for each input Value node (modifying the grad field of each Value)
     // the gradient of this value w.r.t itself is 1.0, so a guaranteed outcome is that after calling backward on some final output Value node, that node will have grad = 1.0
-    void backward();
+    // if this node was recorded on the current Tape (see tape.h), the tape is walked in reverse instead of sorting the graph
+    //
+    // with retain_graph = false, every node drops the edges to its operands as soon as its grad has been propagated, so
+    // intermediate nodes are freed during the pass instead of with the root. Only nodes still held elsewhere survive
+    // (with their data and grad, but no operands), and the graph can't be backpropagated again.
+    void backward(bool retain_graph = true);
+
+    /**
+     * Scratch state for graph traversals (topo_sort, to_dot), so they can mark nodes without a hash set keyed by node.
+     * Each traversal takes a fresh epoch from new_traversal_epoch(); mark_visited stamps the node with it and returns
+     * true the first time the node is seen in that traversal (resetting its counter), false after that. One traversal
+     * at a time per graph: two threads must not walk graphs that share nodes concurrently.
+     */
+    bool mark_visited(uint64_t epoch)
+    {
+        if (visit_epoch == epoch)
+        {
+            return false;
+        }
+        visit_epoch = epoch;
+        visit_counter = 0;
+        return true;
+    }
+    // whether the node was marked in that traversal, without marking it
+    bool was_visited(uint64_t epoch) const
+    {
+        return visit_epoch == epoch;
+    }
+    uint32_t &traversal_counter()
+    {
+        return visit_counter;
+    }
+
+    // drops the edges to the operands (see backward(false)), turning the node into a leaf that keeps its data and grad
+    void release_operands()
+    {
+        prev.clear();
+        op = nullptr;
+        op_kind = OpKind::Custom;
+    }
     
 private:
     float data; // scalar value held by this Value node
@@ -95,13 +225,37 @@ private:
     // in the computation graph of the final value, this value will be one of the nodes
     // if this is 0, it means this value has not effect on the final output
 
+    float *data_ptr = &data; // points at data, or at this node's slot in a ParameterStore
+    float *grad_ptr = &grad; // same for grad
 
-    std::vector<std::shared_ptr<Value>> prev;   // if this value is the result of an operation, store the operands
+    OperandList prev;   // if this value is the result of an operation, store the operands
     std::shared_ptr<const Operation> op = nullptr; // the operation that produced this value, if its not an operation, this is null
-    std::optional<std::string> label = std::nullopt;
+    bool constant = false;
+    OpKind op_kind = OpKind::Custom;
+    bool labeled = false; // whether the label side table has an entry for this node
+    uint8_t label_arena = 0; // label id of the GraphArena whose table has it, 0 for the shared table
+    uint32_t visit_counter = 0; // per-traversal scratch, e.g. remaining in-degree in topo_sort
+    uint64_t visit_epoch = 0;   // last traversal that reached this node
+    [[no_unique_address]] LiveValueCounter live_counter; // takes no space
+
+    static OpKind kind_of(const std::shared_ptr<const Operation> &op)
+    {
+        return op != nullptr ? op->kind() : OpKind::Custom;
+    }
 };
 
 
+static_assert(sizeof(Value) <= 112, "a Value and its shared_ptr control block should fit in two cache lines");
+
+/**
+ * Labels live in a side table keyed by node rather than in every Value, and are only recorded while this is on: by
+ * default when DRAW_GRAPHS or DEBUG is set in constants.h. While it is off, set_label and the label arguments of
+ * make_value/make_parameter are ignored, and networks don't build their per-weight labels. Labels are only needed for
+ * drawing and debugging graphs (see vis.h).
+ */
+void set_record_labels(bool record);
+bool recording_labels();
+
 std::ostream &operator<<(std::ostream &os, const Operation &op);
 
 
@@ -116,3 +270,21 @@ std::ostream &operator<<(std::ostream &os, const std::shared_ptr<Value> &v);
  * Allows use to compute derivates for general functions of from f(x), where f is any callable object
  */
 std::shared_ptr<Value> make_value(float x, const std::optional<std::string>& label = std::nullopt);
+
+// every node reachable from out, ordered so that each node comes before its operands (out first).
+// Iterative, so graphs of any depth can be sorted; throws if the graph has a cycle.
+std::vector<std::shared_ptr<Value>> topo_sort(const std::shared_ptr<Value> out);
+// same, for every node reachable from any of outs
+std::vector<std::shared_ptr<Value>> topo_sort(std::span<const std::shared_ptr<Value>> outs);
+
+// a new epoch for Value::mark_visited, never handed out before (process-wide)
+uint64_t new_traversal_epoch();
+
+// same as make_value, but marks the leaf as a constant (see Value::is_constant)
+std::shared_ptr<Value> make_constant(float x);
+
+// same as make_value, but never allocated from the current GraphArena, for values that outlive a training step (e.g. weights)
+std::shared_ptr<Value> make_parameter(float x, const std::optional<std::string>& label = std::nullopt);
+
+// creates the output node of an operation. Allocated from the current GraphArena if there is one, otherwise from the heap.
+std::shared_ptr<Value> make_node(float data, std::span<const std::shared_ptr<Value>> prev, const std::shared_ptr<const Operation>& op);
@@ -0,0 +1,471 @@
+/**
+ * Benchmark suite: microbenchmarks of every operation, graph construction, topo sort and backward, op dispatch in the
+ * backward loop, end-to-end training steps over a grid of network widths, depths and batch sizes, and compile-time
+ * shaped networks.
+ *
+ * Results go to stdout as JSON (progress goes to stderr), so runs can be saved and compared:
+ *
+ *     make bench && ./bench > before.json
+ *     ./bench --filter train/ --min-time 1
+ *
+ * Options: --filter <substring> runs only the benchmarks whose name contains it, --min-time <seconds> is how long each
+ * benchmark repeats (default 0.2), --quick shrinks the training grid to its smallest sizes.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "autograd.h"
+#include "arena.h"
+#include "network.h"
+#include "optimizer.h"
+#include "static_network.h"
+#include "tape.h"
+#include "tensor.h"
+using namespace operation;
+
+// every heap allocation of the process goes through these, so a benchmark can report how many it made
+static std::atomic<size_t> allocation_count{0};
+
+void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void *p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+// high-water mark of the resident set so far, in KB (Linux reports ru_maxrss in KB)
+static long peak_rss_kb()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct BenchResult
+{
+    std::string name;
+    std::map<std::string, double> params; // e.g. width, depth, batch
+    size_t iterations = 0;
+    double ns_per_iter = 0;
+    double ops_per_iter = 0;   // what ns_per_op is relative to: ops, parameters, training steps...
+    double nodes_per_iter = 0; // graph nodes created or visited per iteration, 0 if not meaningful
+    double allocs_per_iter = 0;
+    long peak_rss_kb = 0; // of the whole process up to the end of this benchmark, so it only grows over a run
+};
+
+class BenchRunner
+{
+public:
+    BenchRunner(std::string filter, double min_time) : filter(std::move(filter)), min_time(min_time) {}
+
+    /**
+     * Repeats iteration for at least min_time seconds (and at least once, after one untimed warmup), recording time
+     * and allocations per iteration. ops and nodes are per iteration.
+     */
+    void run(const std::string &name, const std::function<void()> &iteration, double ops = 1, double nodes = 0,
+             std::map<std::string, double> params = {})
+    {
+        if (name.find(filter) == std::string::npos)
+        {
+            return;
+        }
+        std::cerr << name << "..." << std::flush;
+        iteration();
+
+        size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+        size_t iterations = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed{0};
+        do
+        {
+            iteration();
+            iterations++;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed.count() < min_time);
+        size_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+
+        BenchResult result;
+        result.name = name;
+        result.params = std::move(params);
+        result.iterations = iterations;
+        result.ns_per_iter = elapsed.count() * 1e9 / iterations;
+        result.ops_per_iter = ops;
+        result.nodes_per_iter = nodes;
+        result.allocs_per_iter = static_cast<double>(allocations) / iterations;
+        result.peak_rss_kb = peak_rss_kb();
+        std::cerr << " " << result.ns_per_iter / ops << " ns/op" << std::endl;
+        results.push_back(std::move(result));
+    }
+
+    void write_json(std::ostream &os) const
+    {
+        os << "{\n  \"min_time_s\": " << min_time << ",\n  \"peak_rss_kb\": " << peak_rss_kb() << ",\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const BenchResult &r = results[i];
+            os << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r.name << "\"";
+            for (const auto &[key, value] : r.params)
+            {
+                os << ", \"" << key << "\": " << value;
+            }
+            os << ", \"iterations\": " << r.iterations << ", \"ns_per_iter\": " << r.ns_per_iter << ", \"ns_per_op\": " << r.ns_per_iter / r.ops_per_iter;
+            if (r.nodes_per_iter > 0)
+            {
+                os << ", \"nodes_per_iter\": " << r.nodes_per_iter << ", \"nodes_per_s\": " << r.nodes_per_iter * 1e9 / r.ns_per_iter;
+            }
+            os << ", \"allocs_per_iter\": " << r.allocs_per_iter << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+private:
+    std::string filter;
+    double min_time;
+    std::vector<BenchResult> results;
+};
+
+static float random_float()
+{
+    return static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+}
+
+static std::vector<std::shared_ptr<Value>> random_values(size_t n)
+{
+    std::vector<std::shared_ptr<Value>> values;
+    for (size_t i = 0; i < n; i++)
+    {
+        values.push_back(make_value(random_float()));
+    }
+    return values;
+}
+
+// forward (node creation) and backward (grad propagation into the operands) of each operation on its own
+static void bench_operations(BenchRunner &runner)
+{
+    constexpr size_t N_OPS = 1024; // ops per iteration, so the clock isn't read around every single op
+    constexpr size_t LINEAR_WIDTH = 64;
+    auto a = random_values(N_OPS);
+    auto b = random_values(N_OPS);
+    for (auto &v : b)
+    {
+        v->set_data(v->get_data() + 2.0f); // keeps divisions away from 0
+    }
+    auto weights = random_values(LINEAR_WIDTH);
+    auto x = random_values(LINEAR_WIDTH);
+    auto bias = make_value(0.1f);
+
+    using BuildFn = std::function<std::shared_ptr<Value>(size_t)>;
+    std::vector<std::pair<std::string, BuildFn>> ops = {
+        {"add", [&](size_t i) { return a[i] + b[i]; }},
+        {"subtract", [&](size_t i) { return a[i] - b[i]; }},
+        {"multiply", [&](size_t i) { return a[i] * b[i]; }},
+        {"divide", [&](size_t i) { return a[i] / b[i]; }},
+        {"exp", [&](size_t i) { return exp(a[i]); }},
+        {"tanh", [&](size_t i) { return tanh(a[i]); }},
+        {"linear" + std::to_string(LINEAR_WIDTH), [&](size_t) { return linear(weights, x, bias); }},
+        {"linear" + std::to_string(LINEAR_WIDTH) + "_tanh", [&](size_t) { return linear(weights, x, bias, Activation::Tanh); }},
+        {"linear" + std::to_string(LINEAR_WIDTH) + "_relu", [&](size_t) { return linear(weights, x, bias, Activation::ReLU); }},
+    };
+    for (const auto &[name, build] : ops)
+    {
+        std::vector<std::shared_ptr<Value>> out(N_OPS);
+        runner.run("op/" + name + "/forward", [&]() {
+            for (size_t i = 0; i < N_OPS; i++)
+            {
+                out[i] = build(i); // also frees the node of the previous iteration, as a training loop would
+            }
+        }, N_OPS, N_OPS);
+        runner.run("op/" + name + "/backward", [&]() {
+            for (const auto &node : out)
+            {
+                node->get_operation()->backward(node->get_prev(), *node);
+            }
+        }, N_OPS, N_OPS);
+    }
+}
+
+// batch of inputs for the scalar path of a network, along with the Values backing it
+struct ScalarBatch
+{
+    std::vector<std::shared_ptr<Value>> values;
+    std::vector<network_input_t> inputs;
+    std::vector<float> targets;
+};
+
+static ScalarBatch make_scalar_batch(size_t batch, size_t num_inputs)
+{
+    ScalarBatch b;
+    b.values = random_values(batch * num_inputs);
+    for (size_t i = 0; i < batch; i++)
+    {
+        b.inputs.push_back(network_input_t(b.values).subspan(i * num_inputs, num_inputs));
+        b.targets.push_back(random_float());
+    }
+    return b;
+}
+
+static std::shared_ptr<Value> scalar_loss(const FullyConnectedNetwork &net, ScalarBatch &b)
+{
+    auto outputs = net(b.inputs);
+    std::shared_ptr<Value> loss = make_value(0.0f);
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        auto diff = outputs[i][0] - b.targets[i];
+        loss = loss + diff * diff;
+    }
+    return loss;
+}
+
+static std::vector<int> hidden_layers(size_t width, size_t depth)
+{
+    std::vector<int> layers(depth, static_cast<int>(width));
+    layers.push_back(1);
+    return layers;
+}
+
+// building, sorting and backpropagating through the graph of a mid-sized network
+static void bench_graph(BenchRunner &runner)
+{
+    constexpr size_t WIDTH = 64, DEPTH = 2, BATCH = 16;
+    std::map<std::string, double> params{{"width", WIDTH}, {"depth", DEPTH}, {"batch", BATCH}};
+    FullyConnectedNetwork net(WIDTH, hidden_layers(WIDTH, DEPTH));
+    auto batch = make_scalar_batch(BATCH, WIDTH);
+    auto loss = scalar_loss(net, batch);
+    double nodes = topo_sort(loss).size();
+
+    runner.run("graph/build", [&]() { loss = scalar_loss(net, batch); }, nodes, nodes, params);
+    GraphArena arena;
+    runner.run("graph/build_arena", [&]() {
+        {
+            ArenaScope scope(arena);
+            scalar_loss(net, batch);
+        }
+        arena.reset();
+    }, nodes, nodes, params);
+    runner.run("graph/topo_sort", [&]() { topo_sort(loss); }, nodes, nodes, params);
+    runner.run("graph/backward", [&]() { loss->backward(); }, nodes, nodes, params);
+    Tape tape;
+    runner.run("graph/build_and_backward_taped", [&]() {
+        RecordingScope recording(tape);
+        scalar_loss(net, batch)->backward();
+    }, nodes, nodes, params);
+    runner.run("graph/build_and_backward_release", [&]() { scalar_loss(net, batch)->backward(false); }, nodes, nodes, params);
+}
+
+/**
+ * The backward loop alone, over nodes sorted once up front, dispatching each node through the virtual
+ * Operation::backward (with its operand count check) or through backward_node's switch. On graphs of small scalar ops
+ * the dispatch is a good part of the cost; on the network graph its wide linear nodes dominate.
+ */
+static void bench_dispatch(BenchRunner &runner)
+{
+    auto run_loops = [&](const std::string &graph, const std::shared_ptr<Value> &root) {
+        std::vector<Value *> nodes;
+        for (const auto &v : topo_sort(root))
+        {
+            if (v->get_operation() != nullptr)
+            {
+                nodes.push_back(v.get());
+            }
+        }
+        double n = nodes.size();
+        runner.run("backward_loop/" + graph + "/virtual", [&]() {
+            for (Value *v : nodes)
+            {
+                v->get_operation()->backward(v->get_prev(), *v);
+            }
+        }, n, n);
+        runner.run("backward_loop/" + graph + "/switch", [&]() {
+            for (Value *v : nodes)
+            {
+                backward_node(*v);
+            }
+        }, n, n);
+    };
+
+    // sum of tanh(a*b + c) - exp(c)/b over independent terms, every node a one- or two-operand op
+    constexpr size_t TERMS = 20000;
+    auto a = random_values(TERMS), b = random_values(TERMS), c = random_values(TERMS);
+    std::shared_ptr<Value> ops_loss = make_value(0.0f);
+    for (size_t i = 0; i < TERMS; i++)
+    {
+        ops_loss = ops_loss + (tanh(a[i] * b[i] + c[i]) - exp(c[i]) / (b[i] + 2.0f));
+    }
+    run_loops("scalar_ops", ops_loss);
+
+    FullyConnectedNetwork net(64, hidden_layers(64, 2));
+    auto batch = make_scalar_batch(16, 64);
+    run_loops("network", scalar_loss(net, batch));
+}
+
+/**
+ * One full training step (forward over the batch, loss, zero_grad, backward, SGD step) over a grid of network sizes,
+ * through the scalar path (graph in a GraphArena, recorded on a Tape, as in main.cpp) and the tensor path.
+ */
+static void bench_training(BenchRunner &runner, bool quick)
+{
+    std::vector<size_t> widths = quick ? std::vector<size_t>{16} : std::vector<size_t>{16, 64, 256};
+    std::vector<size_t> depths = quick ? std::vector<size_t>{1, 2} : std::vector<size_t>{1, 2, 4};
+    std::vector<size_t> batches = quick ? std::vector<size_t>{1, 16} : std::vector<size_t>{1, 16, 64};
+    for (size_t width : widths)
+    {
+        for (size_t depth : depths)
+        {
+            for (size_t batch_size : batches)
+            {
+                std::map<std::string, double> params{{"width", width}, {"depth", depth}, {"batch", batch_size}};
+                std::string suffix = "/w" + std::to_string(width) + "/d" + std::to_string(depth) + "/b" + std::to_string(batch_size);
+                FullyConnectedNetwork net(width, hidden_layers(width, depth));
+                Optimizer opt(net.trainable_parameters(), 1e-4f);
+
+                auto batch = make_scalar_batch(batch_size, width);
+                double nodes = topo_sort(scalar_loss(net, batch)).size();
+                GraphArena arena;
+                Tape tape;
+                runner.run("train/scalar" + suffix, [&]() {
+                    {
+                        ArenaScope scope(arena);
+                        RecordingScope recording(tape);
+                        auto loss = scalar_loss(net, batch);
+                        opt.zero_grad();
+                        loss->backward();
+                        opt.step();
+                    }
+                    arena.reset();
+                }, 1, nodes, params);
+
+                std::vector<float> x(batch_size * width), y(batch_size);
+                for (auto &v : x)
+                {
+                    v = random_float();
+                }
+                for (auto &v : y)
+                {
+                    v = random_float();
+                }
+                runner.run("train/tensor" + suffix, [&]() {
+                    auto diff = net(make_tensor(batch_size, width, x)) - make_tensor(batch_size, 1, y);
+                    auto loss = sum(diff * diff);
+                    opt.zero_grad();
+                    loss->backward();
+                    opt.step();
+                }, 1, 0, params);
+            }
+        }
+    }
+}
+
+// a compile-time network against the same shape sized at runtime, for inference and for one sample's forward + backward
+static void bench_static_network(BenchRunner &runner)
+{
+    constexpr size_t WIDTH = 16;
+    std::map<std::string, double> params{{"width", WIDTH}, {"depth", 2}};
+    StaticFCNetwork<WIDTH, WIDTH, WIDTH, 1> static_net;
+    FullyConnectedNetwork net(WIDTH, hidden_layers(WIDTH, 2));
+    decltype(static_net)::input_t x;
+    for (float &v : x)
+    {
+        v = random_float();
+    }
+    float target = random_float();
+    std::vector<float> out(1);
+    volatile float sink = 0.0f; // keeps the inlined predict from being optimized away
+
+    runner.run("static/predict", [&]() { sink = static_net.predict(x)[0]; }, 1, 0, params);
+    runner.run("static/predict_runtime_shape", [&]() { net.predict(x, out); }, 1, 0, params);
+    runner.run("static/forward_backward", [&]() { static_net.forward_backward(x, {target}); }, 1, 0, params);
+    auto batch = make_scalar_batch(1, WIDTH);
+    GraphArena arena;
+    Tape tape;
+    runner.run("static/forward_backward_graph", [&]() {
+        {
+            ArenaScope scope(arena);
+            RecordingScope recording(tape);
+            scalar_loss(net, batch)->backward();
+        }
+        arena.reset();
+    }, 1, 0, params);
+}
+
+// the update alone of every optimizer, per parameter
+static void bench_optimizers(BenchRunner &runner)
+{
+    FullyConnectedNetwork net(32, {256, 256, 1});
+    double n = net.trainable_parameters().size();
+    std::map<std::string, double> params{{"parameters", n}};
+    Optimizer sgd(net.trainable_parameters(), 1e-6f);
+    runner.run("optimizer/sgd", [&]() { sgd.step(); }, n, 0, params);
+    SGDMomentum momentum(net.parameter_store(), 1e-6f);
+    runner.run("optimizer/sgd_momentum", [&]() { momentum.step(); }, n, 0, params);
+    SGDMomentum nesterov(net.parameter_store(), 1e-6f, 0.9f, true);
+    runner.run("optimizer/nesterov", [&]() { nesterov.step(); }, n, 0, params);
+    Adam adam(net.parameter_store(), 1e-6f);
+    runner.run("optimizer/adam", [&]() { adam.step(); }, n, 0, params);
+    AdamW adamw(net.parameter_store(), 1e-6f);
+    runner.run("optimizer/adamw", [&]() { adamw.step(); }, n, 0, params);
+    runner.run("optimizer/zero_grad", [&]() { adam.zero_grad(); }, n, 0, params);
+}
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    double min_time = 0.2;
+    bool quick = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (arg == "--min-time" && i + 1 < argc)
+        {
+            min_time = std::atof(argv[++i]);
+        }
+        else if (arg == "--quick")
+        {
+            quick = true;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <seconds>] [--quick]" << std::endl;
+            return 1;
+        }
+    }
+
+    srand(42);
+    BenchRunner runner(filter, min_time);
+    bench_operations(runner);
+    bench_graph(runner);
+    bench_dispatch(runner);
+    bench_training(runner, quick);
+    bench_static_network(runner);
+    bench_optimizers(runner);
+    runner.write_json(std::cout);
+    return 0;
+}
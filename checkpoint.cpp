@@ -0,0 +1,188 @@
+/**
+ * Saving and restoring trained networks (and optimizer state) in a versioned binary format.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "checkpoint.h"
+
+// everything a checkpoint file holds, copied out of the network and optimizer so that it can be written later
+struct CheckpointSnapshot
+{
+    CheckpointHeader header{};
+    std::vector<CheckpointLayer> layers;
+    std::vector<float> parameters;
+    std::vector<float> state;
+};
+
+static CheckpointSnapshot take_snapshot(const FullyConnectedNetwork &net, const FusedOptimizer *optimizer)
+{
+    CheckpointSnapshot snapshot;
+    const auto &widths = net.get_layer_widths();
+    const auto &activations = net.get_activations();
+    for (size_t i = 0; i < activations.size(); i++)
+    {
+        snapshot.layers.push_back({static_cast<uint32_t>(widths[i + 1]), static_cast<uint32_t>(activations[i])});
+    }
+    auto parameters = net.parameter_store().data();
+    snapshot.parameters.assign(parameters.begin(), parameters.end());
+
+    CheckpointHeader &header = snapshot.header;
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.num_inputs = static_cast<uint32_t>(net.num_inputs());
+    header.num_layers = static_cast<uint32_t>(snapshot.layers.size());
+    header.num_parameters = snapshot.parameters.size();
+    size_t table_end = sizeof(CheckpointHeader) + snapshot.layers.size() * sizeof(CheckpointLayer);
+    header.data_offset = (table_end + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+    if (optimizer != nullptr)
+    {
+        if (optimizer->size() != snapshot.parameters.size())
+        {
+            throw std::invalid_argument("Optimizer of " + std::to_string(optimizer->size()) + " parameters does not belong to a network of " + std::to_string(snapshot.parameters.size()) + " parameters");
+        }
+        std::string name = optimizer->get_name();
+        if (name.size() >= sizeof(header.optimizer))
+        {
+            throw std::invalid_argument("Optimizer name too long for a checkpoint: " + name);
+        }
+        std::memcpy(header.optimizer, name.data(), name.size());
+        auto state = optimizer->get_state();
+        snapshot.state.assign(state.begin(), state.end());
+        header.num_state = snapshot.state.size();
+        header.optimizer_steps = optimizer->get_step_count();
+    }
+    return snapshot;
+}
+
+static void write_snapshot(const std::string &path, const CheckpointSnapshot &snapshot)
+{
+    // write next to the target and rename over it, so readers never see a half-written checkpoint
+    std::string tmp_path = path + ".tmp";
+    FILE *file = std::fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("Could not open " + tmp_path + " for writing: " + std::strerror(errno));
+    }
+    size_t table_end = sizeof(CheckpointHeader) + snapshot.layers.size() * sizeof(CheckpointLayer);
+    char padding[CHECKPOINT_ALIGNMENT] = {};
+    bool ok = std::fwrite(&snapshot.header, sizeof(CheckpointHeader), 1, file) == 1;
+    ok = ok && (snapshot.layers.empty() || std::fwrite(snapshot.layers.data(), sizeof(CheckpointLayer), snapshot.layers.size(), file) == snapshot.layers.size());
+    ok = ok && (snapshot.header.data_offset == table_end || std::fwrite(padding, snapshot.header.data_offset - table_end, 1, file) == 1);
+    ok = ok && (snapshot.parameters.empty() || std::fwrite(snapshot.parameters.data(), sizeof(float), snapshot.parameters.size(), file) == snapshot.parameters.size());
+    ok = ok && (snapshot.state.empty() || std::fwrite(snapshot.state.data(), sizeof(float), snapshot.state.size(), file) == snapshot.state.size());
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Failed writing checkpoint " + path);
+    }
+}
+
+void save_checkpoint(const std::string &path, const FullyConnectedNetwork &net, const FusedOptimizer *optimizer)
+{
+    write_snapshot(path, take_snapshot(net, optimizer));
+}
+
+std::future<void> save_checkpoint_async(const std::string &path, const FullyConnectedNetwork &net, const FusedOptimizer *optimizer)
+{
+    return std::async(std::launch::async, [path, snapshot = take_snapshot(net, optimizer)]() { write_snapshot(path, snapshot); });
+}
+
+// checks the header of a mapped checkpoint, and returns it along with its layer table
+static const CheckpointHeader &read_header(const MappedFile &file, const std::string &path, std::span<const CheckpointLayer> &layers)
+{
+    if (file.size() < sizeof(CheckpointHeader))
+    {
+        throw std::runtime_error("Checkpoint " + path + " is too small to hold a header");
+    }
+    const auto &header = *reinterpret_cast<const CheckpointHeader *>(file.data());
+    if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION || header.data_offset % CHECKPOINT_ALIGNMENT != 0 ||
+        header.data_offset < sizeof(CheckpointHeader) + size_t(header.num_layers) * sizeof(CheckpointLayer) ||
+        file.size() < header.data_offset + (header.num_parameters + header.num_state) * sizeof(float))
+    {
+        throw std::runtime_error("Checkpoint " + path + " is not a version " + std::to_string(CHECKPOINT_VERSION) + " checkpoint file, or is truncated");
+    }
+    layers = {reinterpret_cast<const CheckpointLayer *>(file.data() + sizeof(CheckpointHeader)), header.num_layers};
+    return header;
+}
+
+// the shape of a checkpointed network, checked against its parameter count
+static void read_shape(const CheckpointHeader &header, std::span<const CheckpointLayer> layers, const std::string &path,
+                       std::vector<size_t> &widths, std::vector<Activation> &activations)
+{
+    widths = {header.num_inputs};
+    activations.clear();
+    size_t num_parameters = 0;
+    for (const auto &layer : layers)
+    {
+        if (layer.activation > static_cast<uint32_t>(Activation::ReLU))
+        {
+            throw std::runtime_error("Checkpoint " + path + " has an unknown activation " + std::to_string(layer.activation));
+        }
+        num_parameters += layer.size * (widths.back() + 1);
+        widths.push_back(layer.size);
+        activations.push_back(static_cast<Activation>(layer.activation));
+    }
+    if (layers.empty() || num_parameters != header.num_parameters)
+    {
+        throw std::runtime_error("Checkpoint " + path + " has " + std::to_string(header.num_parameters) + " parameters, which does not match its layers");
+    }
+}
+
+FullyConnectedNetwork load_network(const std::string &path)
+{
+    MappedFile file(path);
+    std::span<const CheckpointLayer> layers;
+    const CheckpointHeader &header = read_header(file, path, layers);
+    std::vector<size_t> widths;
+    std::vector<Activation> activations;
+    read_shape(header, layers, path, widths, activations);
+
+    std::vector<int> layer_sizes(widths.begin() + 1, widths.end());
+    FullyConnectedNetwork net(static_cast<int>(widths[0]), layer_sizes, activations);
+    auto data = net.parameter_store().data();
+    std::memcpy(data.data(), file.data() + header.data_offset, data.size_bytes());
+    return net;
+}
+
+void load_optimizer_state(const std::string &path, FusedOptimizer &optimizer)
+{
+    MappedFile file(path);
+    std::span<const CheckpointLayer> layers;
+    const CheckpointHeader &header = read_header(file, path, layers);
+    std::string name(header.optimizer, strnlen(header.optimizer, sizeof(header.optimizer)));
+    if (name.empty())
+    {
+        throw std::runtime_error("Checkpoint " + path + " was saved without optimizer state");
+    }
+    if (name != optimizer.get_name() || header.num_parameters != optimizer.size())
+    {
+        throw std::invalid_argument("Checkpoint " + path + " holds the state of " + name + " over " + std::to_string(header.num_parameters) +
+                                    " parameters, which can't be loaded into " + optimizer.get_name() + " over " + std::to_string(optimizer.size()));
+    }
+    const float *state = reinterpret_cast<const float *>(file.data() + header.data_offset) + header.num_parameters;
+    optimizer.set_state({state, header.num_state});
+    optimizer.set_step_count(header.optimizer_steps);
+}
+
+MappedNetwork::MappedNetwork(const std::string &path) : file(path)
+{
+    std::span<const CheckpointLayer> layers;
+    const CheckpointHeader &header = read_header(file, path, layers);
+    read_shape(header, layers, path, layer_widths, layer_activations);
+    params = reinterpret_cast<const float *>(file.data() + header.data_offset);
+}
+
+void MappedNetwork::predict(std::span<const float> x, std::span<float> out) const
+{
+    predict_fully_connected(layer_widths, layer_activations, params, x, out);
+}
+
+std::vector<float> MappedNetwork::predict(std::span<const float> x) const
+{
+    std::vector<float> out(num_outputs());
+    predict(x, out);
+    return out;
+}
@@ -0,0 +1,87 @@
+/**
+ * Saving and restoring trained networks (and optimizer state) in a versioned binary format.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <span>
+#include <string>
+#include <vector>
+#pragma once
+#include "mapped_file.h"
+#include "network.h"
+#include "optimizer.h"
+
+/**
+ * File layout (native byte order):
+ *   CheckpointHeader
+ *   num_layers CheckpointLayer entries
+ *   zero padding up to data_offset (a multiple of CHECKPOINT_ALIGNMENT)
+ *   num_parameters floats: the parameters, in FullyConnectedNetwork::parameter_store() order
+ *   num_state floats: the optimizer state (FusedOptimizer::get_state()), if one was saved
+ *
+ * All parameters are one aligned blob, so loading is a single copy, and inference can run straight from the mapped
+ * file (see MappedNetwork).
+ */
+struct CheckpointHeader
+{
+    uint32_t magic;           // CHECKPOINT_MAGIC
+    uint32_t version;         // CHECKPOINT_VERSION
+    uint32_t num_inputs;
+    uint32_t num_layers;
+    uint64_t num_parameters;
+    uint64_t num_state;       // 0 if saved without an optimizer
+    uint64_t optimizer_steps;
+    char optimizer[16];       // FusedOptimizer::get_name(), zero padded, empty if saved without an optimizer
+    uint64_t data_offset;     // byte offset of the parameters
+};
+
+struct CheckpointLayer
+{
+    uint32_t size;
+    uint32_t activation; // Activation
+};
+
+inline constexpr uint32_t CHECKPOINT_MAGIC = 0x4b434741; // "AGCK"
+inline constexpr uint32_t CHECKPOINT_VERSION = 1;
+inline constexpr size_t CHECKPOINT_ALIGNMENT = 64;
+
+// writes net (and the state of optimizer, if given) to path. The file is replaced atomically, so a crash mid-save
+// leaves the previous checkpoint intact.
+void save_checkpoint(const std::string &path, const FullyConnectedNetwork &net, const FusedOptimizer *optimizer = nullptr);
+
+/**
+ * Same as save_checkpoint, but only the snapshot of the parameters and optimizer state (one copy of each contiguous
+ * buffer) happens on the calling thread; the file is written on a background thread. Training can go on as soon as
+ * this returns. The future reports write errors, and its destructor waits for the write to finish.
+ */
+std::future<void> save_checkpoint_async(const std::string &path, const FullyConnectedNetwork &net, const FusedOptimizer *optimizer = nullptr);
+
+// a new network with the shape, activations and parameters saved in path
+FullyConnectedNetwork load_network(const std::string &path);
+
+// restores the state and step count saved in path into optimizer, which must be of the same kind and size
+void load_optimizer_state(const std::string &path, FusedOptimizer &optimizer);
+
+/**
+ * Inference straight from a checkpoint file: the file is mapped and predict() reads the parameters in place, so
+ * "loading" does no parsing or copying, and pages are read from disk on first use.
+ */
+class MappedNetwork
+{
+public:
+    explicit MappedNetwork(const std::string &path);
+
+    // same as FullyConnectedNetwork::predict
+    void predict(std::span<const float> x, std::span<float> out) const;
+    std::vector<float> predict(std::span<const float> x) const;
+
+    size_t num_inputs() const { return layer_widths.front(); }
+    size_t num_outputs() const { return layer_widths.back(); }
+
+private:
+    MappedFile file;
+    std::vector<size_t> layer_widths;
+    std::vector<Activation> layer_activations;
+    const float *params = nullptr;
+};
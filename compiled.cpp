@@ -0,0 +1,156 @@
+/**
+ * Trace-once / replay-many execution of a fixed computation graph.
+ */
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include "compiled.h"
+#include "profiler.h"
+
+CompiledGraph::CompiledGraph(std::span<const std::shared_ptr<Value>> outputs, std::span<const std::shared_ptr<Value>> inputs) : n_inputs(inputs.size())
+{
+    // tracing is a one-time cost, so a hash map for node -> slot is fine here
+    std::unordered_map<const Value *, uint32_t> slot_of;
+    uint32_t next_slot = 0;
+    for (const auto &input : inputs)
+    {
+        if (!slot_of.emplace(input.get(), next_slot).second)
+        {
+            throw std::invalid_argument("CompiledGraph inputs must be distinct Values");
+        }
+        next_slot++;
+    }
+
+    // iterative post-order dfs: a node gets its slot (and instruction) only after all of its operands did
+    size_t max_arity = 0;
+    std::unordered_map<const Value *, bool> expanded;
+    std::vector<const std::shared_ptr<Value> *> stack;
+    for (const auto &out : outputs)
+    {
+        stack.push_back(&out);
+    }
+    std::reverse(stack.begin(), stack.end());
+    while (!stack.empty())
+    {
+        const auto &v = *stack.back();
+        if (slot_of.count(v.get()))
+        {
+            stack.pop_back();
+            continue;
+        }
+        if (v->get_operation() == nullptr)
+        {
+            // a leaf that isn't an input: parameter or constant
+            slot_of[v.get()] = next_slot;
+            leaves.push_back(v);
+            leaf_slots.push_back(next_slot++);
+            stack.pop_back();
+            continue;
+        }
+        if (!expanded[v.get()])
+        {
+            expanded[v.get()] = true;
+            for (const auto &p : v->get_prev())
+            {
+                if (!slot_of.count(p.get()))
+                {
+                    stack.push_back(&p);
+                }
+            }
+            continue;
+        }
+
+        stack.pop_back();
+        if (!v->get_operation()->has_kernels())
+        {
+            throw std::invalid_argument("CompiledGraph can't replay operation " + v->get_operation()->get_name() + ", which has no apply/local_grads kernels");
+        }
+        const auto &prev = v->get_prev();
+        Instruction instruction{v->get_operation().get(), static_cast<uint32_t>(operand_slots.size()), static_cast<uint32_t>(prev.size()), next_slot};
+        for (const auto &p : prev)
+        {
+            operand_slots.push_back(slot_of.at(p.get()));
+        }
+        if (std::find(ops.begin(), ops.end(), v->get_operation()) == ops.end())
+        {
+            ops.push_back(v->get_operation());
+        }
+        instructions.push_back(instruction);
+        max_arity = std::max(max_arity, prev.size());
+        slot_of[v.get()] = next_slot++;
+    }
+
+    for (const auto &out : outputs)
+    {
+        output_slots.push_back(slot_of.at(out.get()));
+    }
+
+    values.assign(next_slot, 0.0f);
+    grads.assign(next_slot, 0.0f);
+    operand_values.resize(max_arity);
+    operand_grads.resize(max_arity);
+
+    // start from the traced data, so outputs are valid even before the first forward()
+    for (const auto &[node, slot] : slot_of)
+    {
+        values[slot] = node->get_data();
+    }
+}
+
+void CompiledGraph::forward(std::span<const float> input_data)
+{
+    ProfileScope profile("forward", "phase", instructions.size());
+    if (input_data.size() != n_inputs)
+    {
+        throw std::invalid_argument("CompiledGraph expected " + std::to_string(n_inputs) + " inputs, got " + std::to_string(input_data.size()));
+    }
+    std::copy(input_data.begin(), input_data.end(), values.begin());
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+        values[leaf_slots[i]] = leaves[i]->get_data();
+    }
+
+    for (const auto &instruction : instructions)
+    {
+        const uint32_t *operands = operand_slots.data() + instruction.first_operand;
+        for (uint32_t k = 0; k < instruction.n_operands; k++)
+        {
+            operand_values[k] = values[operands[k]];
+        }
+        values[instruction.out] = instruction.op->apply(std::span<const float>(operand_values.data(), instruction.n_operands));
+    }
+}
+
+void CompiledGraph::backward(size_t output_index)
+{
+    ProfileScope profile("backward", "phase", instructions.size());
+    std::fill(grads.begin(), grads.end(), 0.0f);
+    grads[output_slots.at(output_index)] = 1.0f;
+
+    // reverse topological order, same as Value::backward
+    for (auto it = instructions.rbegin(); it != instructions.rend(); ++it)
+    {
+        const auto &instruction = *it;
+        float out_grad = grads[instruction.out];
+        if (out_grad == 0.0f)
+        {
+            continue; // doesn't contribute to this output
+        }
+        const uint32_t *operands = operand_slots.data() + instruction.first_operand;
+        for (uint32_t k = 0; k < instruction.n_operands; k++)
+        {
+            operand_values[k] = values[operands[k]];
+        }
+        instruction.op->local_grads(std::span<const float>(operand_values.data(), instruction.n_operands), values[instruction.out], std::span<float>(operand_grads.data(), instruction.n_operands));
+        for (uint32_t k = 0; k < instruction.n_operands; k++)
+        {
+            grads[operands[k]] += operand_grads[k] * out_grad; // chain rule
+        }
+    }
+
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+        leaves[i]->add_grad(grads[leaf_slots[i]]);
+    }
+}
@@ -0,0 +1,76 @@
+/**
+ * Trace-once / replay-many execution of a fixed computation graph.
+ */
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+#pragma once
+#include "autograd.h"
+
+/**
+ * A CompiledGraph flattens the graph reachable from some output Values into a static execution plan: one instruction per
+ * operation node in topological order, with every node assigned a slot in a flat value buffer and a flat grad buffer.
+ *
+ * When the topology is the same every step (e.g. a FullyConnectedNetwork and its loss over a fixed-size batch), the graph
+ * only has to be built once. After that, forward() and backward() replay the plan on the buffers with no node
+ * construction, no sorting and no allocation:
+ *
+ *     std::vector<std::shared_ptr<Value>> outputs{loss}; // one step's graph, built from input Values
+ *     CompiledGraph plan(outputs, inputs);
+ *     for (...) {
+ *         plan.forward(batch_data);                 // new data for `inputs`, in the same order
+ *         opt.zero_grad();
+ *         plan.backward();                          // grads land in the parameter Values
+ *         opt.step();
+ *     }
+ *
+ * Leaves that are not inputs (parameters, constants) are read from their Value at the start of every forward(), so
+ * optimizer updates are picked up, and backward() accumulates into their Value grads, like Value::backward().
+ * The traced graph's nodes are not needed after construction. Every operation in the graph must have float kernels
+ * (Operation::has_kernels), otherwise the constructor throws std::invalid_argument.
+ */
+class CompiledGraph
+{
+public:
+    CompiledGraph(std::span<const std::shared_ptr<Value>> outputs, std::span<const std::shared_ptr<Value>> inputs);
+
+    // run the plan with new data for the inputs (in the order they were given at trace time)
+    void forward(std::span<const float> input_data);
+
+    // backpropagate from one of the outputs, accumulating into the grads of the leaf Values. Call after forward().
+    void backward(size_t output_index = 0);
+
+    float output(size_t output_index) const { return values[output_slots[output_index]]; }
+    size_t num_outputs() const { return output_slots.size(); }
+
+    // gradient of the last backward() w.r.t one of the inputs
+    float input_grad(size_t input_index) const { return grads[input_index]; }
+
+    size_t num_instructions() const { return instructions.size(); }
+    size_t num_slots() const { return values.size(); }
+
+private:
+    struct Instruction
+    {
+        const Operation *op;
+        uint32_t first_operand; // index into operand_slots
+        uint32_t n_operands;
+        uint32_t out;           // slot of the output
+    };
+
+    size_t n_inputs;                              // inputs take slots [0, n_inputs)
+    std::vector<std::shared_ptr<Value>> leaves;   // parameters/constants, bound to leaf_slots
+    std::vector<uint32_t> leaf_slots;
+    std::vector<std::shared_ptr<const Operation>> ops; // keeps the traced operations alive
+    std::vector<Instruction> instructions;        // in topological order, operands first
+    std::vector<uint32_t> operand_slots;          // flattened operand lists of all instructions
+    std::vector<uint32_t> output_slots;
+
+    std::vector<float> values; // one slot per node
+    std::vector<float> grads;  // one slot per node
+
+    // scratch space for one instruction's operands, sized to the largest arity at trace time
+    std::vector<float> operand_values;
+    std::vector<float> operand_grads;
+};
@@ -1,6 +1,7 @@
 
 #define DEBUG false
 #define DRAW_GRAPHS true // whether to draw computation graphs or not
+#define PROFILING true // compiles in the profiler (see profiler.h), which still has to be turned on with profiler::set_enabled
 #define LEARNING_RATE 0.05f
 #define N_EPOCHS 100
 
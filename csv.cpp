@@ -0,0 +1,238 @@
+/**
+ * CSV ingestion: parallel conversion to the binary dataset format, and a streaming reader for training straight from CSV.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "csv.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+// chunks are cut at the first line break after every CHUNK_BYTES, and are the unit of work of a thread
+static constexpr size_t CHUNK_BYTES = 4 << 20;
+
+/**
+ * Parses one line (without its '\n') of delimiter separated floats, appending them to out. Returns the number of fields,
+ * 0 for a blank line. offset is the position of the line in the file, for error messages.
+ */
+static size_t parse_line(const char *begin, const char *end, char delimiter, size_t offset, std::vector<float> &out)
+{
+    if (end > begin && end[-1] == '\r')
+    {
+        end--;
+    }
+    if (begin == end)
+    {
+        return 0;
+    }
+    size_t fields = 0;
+    const char *p = begin;
+    while (true)
+    {
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        if (p < end && *p == '+')
+        {
+            p++; // from_chars only accepts '-'
+        }
+        float value;
+        auto [next, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc())
+        {
+            throw std::runtime_error("Could not parse a float in the CSV line at byte " + std::to_string(offset) + ": " + std::string(begin, end));
+        }
+        out.push_back(value);
+        fields++;
+        p = next;
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            return fields;
+        }
+        if (*p != delimiter)
+        {
+            throw std::runtime_error("Unexpected character '" + std::string(1, *p) + "' in the CSV line at byte " + std::to_string(offset) + ": " + std::string(begin, end));
+        }
+        p++;
+    }
+}
+
+// checks the column count of the first line (header or data) against the options
+static size_t count_columns(const char *begin, const char *end, const CsvOptions &options)
+{
+    size_t n_columns = std::count(begin, end, options.delimiter) + 1;
+    if (n_columns <= options.num_targets)
+    {
+        throw std::invalid_argument("CSV has " + std::to_string(n_columns) + " columns, which leaves no features for " + std::to_string(options.num_targets) + " targets");
+    }
+    return n_columns;
+}
+
+// parses the whole lines in [begin, end) into out, checking that each has n_columns fields
+static void parse_chunk(const char *begin, const char *end, const char *file_start, size_t n_columns, char delimiter, std::vector<float> &out)
+{
+    const char *line = begin;
+    while (line < end)
+    {
+        const char *line_end = static_cast<const char *>(std::memchr(line, '\n', end - line));
+        if (line_end == nullptr)
+        {
+            line_end = end;
+        }
+        size_t offset = line - file_start;
+        size_t fields = parse_line(line, line_end, delimiter, offset, out);
+        if (fields != 0 && fields != n_columns)
+        {
+            throw std::runtime_error("CSV line at byte " + std::to_string(offset) + " has " + std::to_string(fields) + " columns, expected " + std::to_string(n_columns));
+        }
+        line = line_end + 1;
+    }
+}
+
+CsvStats convert_csv(const std::string &csv_path, const std::string &dataset_path, const CsvOptions &options)
+{
+    auto start = std::chrono::steady_clock::now();
+    MappedFile csv(csv_path);
+    csv.advise_random(false);
+    const char *file_start = csv.data();
+    const char *begin = file_start;
+    const char *end = file_start + csv.size();
+
+    const char *first_line_end = std::find(begin, end, '\n');
+    size_t n_columns = count_columns(begin, first_line_end, options);
+    if (options.has_header)
+    {
+        begin = first_line_end == end ? end : first_line_end + 1;
+    }
+
+    std::vector<const char *> bounds{begin};
+    while (bounds.back() < end)
+    {
+        const char *cut = bounds.back() + std::min<size_t>(CHUNK_BYTES, end - bounds.back());
+        cut = std::find(cut, end, '\n');
+        bounds.push_back(cut == end ? end : cut + 1);
+    }
+    size_t n_chunks = bounds.size() - 1;
+
+    ThreadPool pool(options.n_threads);
+    std::vector<std::vector<float>> parsed(pool.size()); // one buffer per chunk of a window, reused across windows
+    DatasetWriter writer(dataset_path, n_columns - options.num_targets, options.num_targets);
+    for (size_t window = 0; window < n_chunks; window += pool.size())
+    {
+        size_t window_size = std::min(pool.size(), n_chunks - window);
+        pool.parallel_for(window_size, [&](size_t i) {
+            parsed[i].clear();
+            parse_chunk(bounds[window + i], bounds[window + i + 1], file_start, n_columns, options.delimiter, parsed[i]);
+        });
+        for (size_t i = 0; i < window_size; i++)
+        {
+            writer.append(parsed[i]);
+        }
+    }
+    writer.finish();
+
+    CsvStats stats;
+    stats.rows = writer.rows_written();
+    stats.bytes = csv.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+
+CsvStream::CsvStream(const std::string &path, const CsvOptions &options, size_t block_size)
+    : path(path), options(options), block_size(std::max<size_t>(block_size, 1))
+{
+    file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    }
+
+    // the first line (header or data) gives the column count
+    const char *newline = find_newline();
+    while (newline == nullptr && refill())
+    {
+        newline = find_newline();
+    }
+    size_t first_line_size = newline != nullptr ? newline - buffer.data() : buffer.size();
+    n_columns = count_columns(buffer.data(), buffer.data() + first_line_size, options);
+    if (options.has_header)
+    {
+        pos = std::min(first_line_size + 1, buffer.size());
+        totals.bytes += pos;
+    }
+}
+
+CsvStream::~CsvStream()
+{
+    std::fclose(file);
+}
+
+const char *CsvStream::find_newline() const
+{
+    if (pos == buffer.size())
+    {
+        return nullptr;
+    }
+    return static_cast<const char *>(std::memchr(buffer.data() + pos, '\n', buffer.size() - pos));
+}
+
+bool CsvStream::refill()
+{
+    // drop what was parsed already, keeping the partial line at the end
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+    buffer_offset += pos;
+    pos = 0;
+
+    size_t old_size = buffer.size();
+    buffer.resize(old_size + block_size);
+    size_t n_read = std::fread(buffer.data() + old_size, 1, block_size, file);
+    buffer.resize(old_size + n_read);
+    return n_read > 0;
+}
+
+std::span<const float> CsvStream::next_rows(size_t max_rows)
+{
+    auto start = std::chrono::steady_clock::now();
+    rows.clear();
+    size_t n_rows = 0;
+    while (n_rows < max_rows)
+    {
+        const char *line = buffer.data() + pos;
+        const char *line_end = find_newline();
+        if (line_end == nullptr)
+        {
+            if (refill())
+            {
+                continue;
+            }
+            if (pos == buffer.size())
+            {
+                break; // end of file
+            }
+            line = buffer.data() + pos;
+            line_end = buffer.data() + buffer.size(); // last line without a line break
+        }
+        size_t line_size = line_end - line;
+        size_t fields = parse_line(line, line_end, options.delimiter, buffer_offset + pos, rows);
+        if (fields != 0 && fields != n_columns)
+        {
+            throw std::runtime_error("CSV line at byte " + std::to_string(buffer_offset + pos) + " of " + path + " has " + std::to_string(fields) + " columns, expected " + std::to_string(n_columns));
+        }
+        n_rows += fields != 0;
+        size_t consumed = std::min(line_size + 1, buffer.size() - pos);
+        pos += consumed;
+        totals.bytes += consumed;
+    }
+    totals.rows += n_rows;
+    totals.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return rows;
+}
@@ -0,0 +1,82 @@
+/**
+ * CSV ingestion: parallel conversion to the binary dataset format, and a streaming reader for training straight from CSV.
+ */
+#include <cstddef>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#pragma once
+#include "dataset.h"
+
+/**
+ * Every line holds the same number of float columns; the last num_targets are the targets, the rest are features.
+ * Floats are parsed with std::from_chars, so the current locale never matters ("1.5", not "1,5").
+ */
+struct CsvOptions
+{
+    char delimiter = ',';
+    bool has_header = true; // skip the first line
+    size_t num_targets = 1;
+    size_t n_threads = std::thread::hardware_concurrency();
+};
+
+struct CsvStats
+{
+    size_t rows = 0;
+    size_t bytes = 0;     // CSV bytes read
+    double seconds = 0.0; // wall time, including writing the output
+
+    double gb_per_second() const { return seconds > 0.0 ? bytes / seconds / 1e9 : 0.0; }
+};
+
+/**
+ * Converts a CSV file to the dataset format of dataset.h. The CSV is memory-mapped and cut into chunks at line
+ * boundaries; a window of chunks is parsed in parallel (one chunk per thread), then written out in order before the
+ * next window, so memory use stays bounded however large the file is.
+ */
+CsvStats convert_csv(const std::string &csv_path, const std::string &dataset_path, const CsvOptions &options = {});
+
+/**
+ * Reads a CSV file front to back in fixed-size blocks, handing out parsed rows a few at a time, e.g. to feed the
+ * training loop directly without first converting the whole file:
+ *
+ *     CsvStream stream("train.csv");
+ *     for (auto rows = stream.next_rows(64); !rows.empty(); rows = stream.next_rows(64)) { ... }
+ *
+ * Parsing is single threaded, use convert_csv for data that is read more than once.
+ */
+class CsvStream
+{
+public:
+    explicit CsvStream(const std::string &path, const CsvOptions &options = {}, size_t block_size = 1 << 20);
+    ~CsvStream();
+    CsvStream(const CsvStream &) = delete;
+    CsvStream &operator=(const CsvStream &) = delete;
+
+    // up to max_rows more rows, row-major with num_columns() floats each. Valid until the next call; empty at the end.
+    std::span<const float> next_rows(size_t max_rows);
+
+    size_t num_columns() const { return n_columns; }
+    size_t num_features() const { return n_columns - options.num_targets; }
+    size_t num_targets() const { return options.num_targets; }
+
+    // rows and bytes consumed so far, and the time spent in next_rows
+    const CsvStats &stats() const { return totals; }
+
+private:
+    bool refill(); // reads one more block into buffer, false at end of file
+    const char *find_newline() const; // first '\n' at or after pos, or nullptr
+
+    std::string path;
+    CsvOptions options;
+    std::FILE *file = nullptr;
+    size_t block_size;
+    std::vector<char> buffer;
+    size_t pos = 0;          // start of the unparsed part of buffer
+    size_t buffer_offset = 0; // file offset of buffer[0], for error messages
+    size_t n_columns = 0;
+    std::vector<float> rows;
+    CsvStats totals;
+};
@@ -0,0 +1,201 @@
+/**
+ * Training data on disk: a fixed-width float32 row format, memory-mapped, and a mini-batch loader over it.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include "dataset.h"
+
+DatasetWriter::DatasetWriter(const std::string &path, size_t num_features, size_t num_targets)
+    : path(path), header{DATASET_MAGIC, DATASET_VERSION, 0, static_cast<uint32_t>(num_features), static_cast<uint32_t>(num_targets),
+                         (sizeof(DatasetHeader) + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT}
+{
+    if (num_features + num_targets == 0)
+    {
+        throw std::invalid_argument("Dataset rows need at least one column");
+    }
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("Could not open " + path + " for writing: " + std::strerror(errno));
+    }
+    // header is rewritten with the final row count in finish()
+    char padding[DATASET_ALIGNMENT] = {};
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1 || std::fwrite(padding, header.data_offset - sizeof(header), 1, file) != 1)
+    {
+        std::fclose(file);
+        file = nullptr;
+        throw std::runtime_error("Failed writing dataset header to " + path);
+    }
+}
+
+DatasetWriter::~DatasetWriter()
+{
+    try
+    {
+        finish();
+    }
+    catch (...)
+    {
+    }
+}
+
+void DatasetWriter::append(std::span<const float> rows)
+{
+    size_t width = size_t(header.num_features) + header.num_targets;
+    if (file == nullptr)
+    {
+        throw std::runtime_error("DatasetWriter::append called after finish() on " + path);
+    }
+    if (rows.size() % width != 0)
+    {
+        throw std::invalid_argument("Dataset rows must be a multiple of num_features + num_targets floats, got " + std::to_string(rows.size()) + " floats for rows of " + std::to_string(width));
+    }
+    if (!rows.empty() && std::fwrite(rows.data(), rows.size_bytes(), 1, file) != 1)
+    {
+        throw std::runtime_error("Failed writing dataset rows to " + path);
+    }
+    header.rows += rows.size() / width;
+}
+
+void DatasetWriter::finish()
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+    bool ok = std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+    if (!ok)
+    {
+        throw std::runtime_error("Failed finishing dataset " + path);
+    }
+}
+
+void write_dataset(const std::string &path, size_t num_features, size_t num_targets, std::span<const float> rows)
+{
+    DatasetWriter writer(path, num_features, num_targets);
+    writer.append(rows);
+    writer.finish();
+}
+
+Dataset::Dataset(const std::string &path) : file(path)
+{
+    if (file.size() < sizeof(DatasetHeader))
+    {
+        throw std::runtime_error("Dataset " + path + " is too small to hold a header");
+    }
+    DatasetHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    size_t expected_size = header.data_offset + header.rows * (size_t(header.num_features) + header.num_targets) * sizeof(float);
+    if (header.magic != DATASET_MAGIC || header.version != DATASET_VERSION || header.data_offset % alignof(float) != 0 || expected_size > file.size())
+    {
+        throw std::runtime_error("Dataset " + path + " is not a version " + std::to_string(DATASET_VERSION) + " dataset file, or is truncated");
+    }
+    data = reinterpret_cast<const float *>(file.data() + header.data_offset);
+    n_rows = header.rows;
+    n_features = header.num_features;
+    n_targets = header.num_targets;
+}
+
+DataLoader::DataLoader(const Dataset &dataset, size_t batch_size, bool shuffle, uint32_t seed)
+    : dataset(dataset), batch_size(batch_size), shuffle(shuffle), seed(seed), order(dataset.rows())
+{
+    if (batch_size == 0)
+    {
+        throw std::invalid_argument("DataLoader batch size must be at least 1");
+    }
+    // with shuffling, readahead past a row is wasted, the prefetcher knows exactly which pages come next
+    dataset.advise_random(shuffle);
+    prefetcher = std::thread([this] { prefetch_loop(); });
+    start_epoch();
+}
+
+DataLoader::~DataLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    requested.notify_one();
+    prefetcher.join();
+}
+
+void DataLoader::start_epoch()
+{
+    std::iota(order.begin(), order.end(), size_t(0));
+    if (shuffle)
+    {
+        // seeded per epoch, so a run is reproducible but every epoch sees a different order
+        std::mt19937_64 rng(seed + epoch);
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+    epoch++;
+    cursor = 0;
+    prefetch(0);
+}
+
+std::optional<Batch> DataLoader::next()
+{
+    if (cursor >= order.size())
+    {
+        return std::nullopt;
+    }
+    size_t begin = cursor;
+    size_t end = std::min(begin + batch_size, order.size());
+    cursor = end;
+    prefetch(end); // overlaps with the caller's work on this batch
+    return Batch{&dataset, std::span<const size_t>(order.data() + begin, end - begin)};
+}
+
+void DataLoader::prefetch(size_t begin)
+{
+    if (begin >= order.size())
+    {
+        return;
+    }
+    size_t end = std::min(begin + batch_size, order.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending_rows.assign(order.begin() + begin, order.begin() + end); // replaces a request not picked up yet
+        has_pending = true;
+    }
+    requested.notify_one();
+}
+
+void DataLoader::prefetch_loop()
+{
+    static constexpr size_t FLOATS_PER_PAGE = 4096 / sizeof(float);
+    std::vector<size_t> rows;
+    volatile float sink = 0.0f; // keeps the reads below from being optimized out
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            requested.wait(lock, [this] { return stopping || has_pending; });
+            if (stopping)
+            {
+                return;
+            }
+            rows.swap(pending_rows);
+            has_pending = false;
+        }
+        // one read per page of each row faults it in, so the training thread finds it resident
+        for (size_t i : rows)
+        {
+            auto row = dataset.row(i);
+            for (size_t k = 0; k < row.size(); k += FLOATS_PER_PAGE)
+            {
+                sink = sink + row[k];
+            }
+            if (!row.empty())
+            {
+                sink = sink + row.back();
+            }
+        }
+    }
+}
@@ -0,0 +1,153 @@
+/**
+ * Training data on disk: a fixed-width float32 row format, memory-mapped, and a mini-batch loader over it.
+ */
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#pragma once
+#include "mapped_file.h"
+
+/**
+ * File layout (native byte order):
+ *   DatasetHeader
+ *   zero padding up to data_offset (a multiple of DATASET_ALIGNMENT)
+ *   rows * (num_features + num_targets) float32, row-major: each row is its features followed by its targets
+ */
+struct DatasetHeader
+{
+    uint32_t magic;        // DATASET_MAGIC
+    uint32_t version;      // DATASET_VERSION
+    uint64_t rows;
+    uint32_t num_features;
+    uint32_t num_targets;
+    uint64_t data_offset;  // byte offset of the first row
+};
+
+inline constexpr uint32_t DATASET_MAGIC = 0x53444741; // "AGDS"
+inline constexpr uint32_t DATASET_VERSION = 1;
+inline constexpr size_t DATASET_ALIGNMENT = 64;
+
+/**
+ * Writes a dataset file incrementally, e.g. while parsing a source that doesn't fit in memory. The row count in the
+ * header is filled in by finish() (or the destructor, which swallows errors; call finish() to see them).
+ */
+class DatasetWriter
+{
+public:
+    DatasetWriter(const std::string &path, size_t num_features, size_t num_targets);
+    ~DatasetWriter();
+    DatasetWriter(const DatasetWriter &) = delete;
+    DatasetWriter &operator=(const DatasetWriter &) = delete;
+
+    // rows is row-major, a whole number of rows of num_features + num_targets floats
+    void append(std::span<const float> rows);
+    void finish();
+
+    size_t rows_written() const { return header.rows; }
+
+private:
+    std::string path;
+    std::FILE *file = nullptr;
+    DatasetHeader header;
+};
+
+// writes rows (row-major, num_features + num_targets floats each) to path in the format above
+void write_dataset(const std::string &path, size_t num_features, size_t num_targets, std::span<const float> rows);
+
+/**
+ * A read-only, memory-mapped dataset file. Rows are handed out as spans straight into the mapping, so nothing is
+ * copied and only the pages that are actually touched get read from disk.
+ */
+class Dataset
+{
+public:
+    explicit Dataset(const std::string &path);
+
+    size_t rows() const { return n_rows; }
+    size_t num_features() const { return n_features; }
+    size_t num_targets() const { return n_targets; }
+    size_t row_width() const { return n_features + n_targets; }
+
+    std::span<const float> row(size_t i) const { return {data + i * row_width(), row_width()}; }
+    std::span<const float> features(size_t i) const { return {data + i * row_width(), n_features}; }
+    std::span<const float> targets(size_t i) const { return {data + i * row_width() + n_features, n_targets}; }
+
+    // hint to the OS about the upcoming access pattern (see DataLoader)
+    void advise_random(bool random) const { file.advise_random(random); }
+
+private:
+    MappedFile file;
+    const float *data = nullptr;
+    size_t n_rows = 0;
+    size_t n_features = 0;
+    size_t n_targets = 0;
+};
+
+/**
+ * A mini-batch: indices of rows in the dataset, read in place. The indices point into the DataLoader, so a batch is
+ * valid until the loader starts its next epoch.
+ */
+struct Batch
+{
+    const Dataset *dataset;
+    std::span<const size_t> indices;
+
+    size_t size() const { return indices.size(); }
+    std::span<const float> features(size_t k) const { return dataset->features(indices[k]); }
+    std::span<const float> targets(size_t k) const { return dataset->targets(indices[k]); }
+};
+
+/**
+ * Hands out the mini-batches of one epoch after another, optionally in a new random order every epoch:
+ *
+ *     DataLoader loader(dataset, 32, true); // ready for the first epoch
+ *     for (size_t epoch = 0; epoch < n_epochs; epoch++) {
+ *         while (auto batch = loader.next()) { ... }
+ *         loader.start_epoch();
+ *     }
+ *
+ * Batches are zero-copy (see Batch). While the caller works on a batch, a background thread touches the pages of the
+ * rows of the next one, so reading them from disk overlaps with compute instead of stalling the training step.
+ */
+class DataLoader
+{
+public:
+    DataLoader(const Dataset &dataset, size_t batch_size, bool shuffle = false, uint32_t seed = 0);
+    ~DataLoader();
+    DataLoader(const DataLoader &) = delete;
+    DataLoader &operator=(const DataLoader &) = delete;
+
+    // rewinds to the first batch, reshuffling the rows if shuffling is on
+    void start_epoch();
+
+    // the next batch of this epoch (the last one may be smaller), or nullopt once the epoch is done
+    std::optional<Batch> next();
+
+    size_t batches_per_epoch() const { return (order.size() + batch_size - 1) / batch_size; }
+
+private:
+    void prefetch(size_t begin); // asks the background thread to touch the rows of the batch starting at order[begin]
+    void prefetch_loop();
+
+    const Dataset &dataset;
+    size_t batch_size;
+    bool shuffle;
+    uint32_t seed;
+    size_t epoch = 0;
+    std::vector<size_t> order; // row indices in the order of this epoch
+    size_t cursor = 0;         // position in order of the next batch
+
+    std::thread prefetcher;
+    std::mutex mutex;
+    std::condition_variable requested;
+    std::vector<size_t> pending_rows; // rows to touch next, a copy so that start_epoch can reshuffle meanwhile; guarded by mutex
+    bool has_pending = false;
+    bool stopping = false;
+};
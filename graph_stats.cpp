@@ -0,0 +1,97 @@
+/**
+ * Memory accounting for computation graphs: what a graph is made of and how many bytes it holds, plus process-wide
+ * counters of live Value objects.
+ */
+#include <algorithm>
+#include <unordered_map>
+#include "graph_stats.h"
+
+// heap bytes behind a string, 0 if it fits in the string object itself (small string optimization)
+static size_t heap_bytes(const std::string &s)
+{
+    const char *begin = reinterpret_cast<const char *>(&s);
+    if (s.data() >= begin && s.data() < begin + sizeof(std::string))
+    {
+        return 0;
+    }
+    return s.capacity() + 1;
+}
+
+// a side table entry: hash node with its next pointer, key, cached hash and the string object
+static constexpr size_t LABEL_ENTRY_BYTES = 3 * sizeof(void *) + sizeof(std::string);
+
+// a use count and a weak count, as in the control blocks of the common standard libraries
+static constexpr size_t CONTROL_BLOCK_COUNTS_BYTES = 2 * sizeof(long);
+
+GraphStats graph_stats(const std::shared_ptr<Value> &root)
+{
+    GraphStats stats;
+    auto sorted = topo_sort(root); // root first, every node before its operands
+
+    std::unordered_map<const Value *, size_t> depth;
+    depth.reserve(sorted.size());
+    std::unordered_map<const Operation *, size_t> by_operation;
+    for (const auto &v : sorted)
+    {
+        size_t d = depth[v.get()];
+        stats.max_depth = std::max(stats.max_depth, d);
+        const auto &prev = v->get_prev();
+        for (const auto &p : prev)
+        {
+            auto &p_depth = depth[p.get()];
+            p_depth = std::max(p_depth, d + 1);
+        }
+
+        stats.nodes++;
+        stats.edges += prev.size();
+        if (v->get_operation() == nullptr)
+        {
+            stats.leaves++;
+        }
+        else
+        {
+            by_operation[v->get_operation().get()]++;
+        }
+        stats.value_bytes += sizeof(Value);
+        stats.prev_bytes += prev.heap_bytes();
+        if (auto label = v->get_label())
+        {
+            stats.label_bytes += LABEL_ENTRY_BYTES + heap_bytes(*label);
+        }
+        stats.control_block_bytes += CONTROL_BLOCK_COUNTS_BYTES;
+    }
+    // operations are shared across nodes, so names are only looked up once per operation
+    for (const auto &[op, count] : by_operation)
+    {
+        stats.nodes_by_operation[op->get_name()] += count;
+    }
+    return stats;
+}
+
+std::ostream &operator<<(std::ostream &os, const GraphStats &stats)
+{
+    os << stats.nodes << " nodes (" << stats.leaves << " leaves";
+    for (const auto &[name, count] : stats.nodes_by_operation)
+    {
+        os << ", " << count << " " << name;
+    }
+    os << "), " << stats.edges << " edges, max depth " << stats.max_depth << ", " << stats.total_bytes() << " bytes (values "
+       << stats.value_bytes << ", operand lists " << stats.prev_bytes << ", labels " << stats.label_bytes << ", control blocks "
+       << stats.control_block_bytes << ")";
+    return os;
+}
+
+size_t live_values()
+{
+    return LiveValueCounter::live.load(std::memory_order_relaxed);
+}
+
+size_t peak_live_values()
+{
+    return LiveValueCounter::peak.load(std::memory_order_relaxed);
+}
+
+void reset_peak_live_values()
+{
+    LiveValueCounter::peak.store(LiveValueCounter::live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
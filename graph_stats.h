@@ -0,0 +1,51 @@
+/**
+ * Memory accounting for computation graphs: what a graph is made of and how many bytes it holds, plus process-wide
+ * counters of live Value objects.
+ */
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#pragma once
+#include "autograd.h"
+
+struct GraphStats
+{
+    size_t nodes = 0;  // every Value reachable from the root, leaves included
+    size_t leaves = 0; // parameters, inputs and constants
+    size_t edges = 0;  // operand references, counted once per use (x * x is 2 edges)
+    size_t max_depth = 0; // longest path from the root to a leaf, in edges
+    std::map<std::string, size_t> nodes_by_operation; // by Operation::get_name(), leaves not included
+
+    // bytes held by the graph, see graph_stats below for what each covers
+    size_t value_bytes = 0;
+    size_t prev_bytes = 0;
+    size_t label_bytes = 0;
+    size_t control_block_bytes = 0;
+    size_t total_bytes() const { return value_bytes + prev_bytes + label_bytes + control_block_bytes; }
+};
+
+/**
+ * Walks the graph from root and reports its shape and memory. The bytes are what the nodes themselves hold:
+ *  - value_bytes: sizeof(Value) per node
+ *  - prev_bytes: operand lists too long to be stored inline in the node (see OperandList), one shared_ptr per operand
+ *  - label_bytes: entries of the label side table (see set_record_labels), with heap buffers of labels too long for
+ *    the small string optimization
+ *  - control_block_bytes: the shared_ptr reference counts stored next to each node (make_shared / allocate_shared put
+ *    node and counts in one allocation; this is the counts' part, estimated for the common two-word layout)
+ * Allocator overhead (malloc headers, arena blocks) and Operation objects, which are shared across nodes, aren't counted.
+ * Parameters in a ParameterStore keep their data and grad there, which isn't counted here either.
+ */
+GraphStats graph_stats(const std::shared_ptr<Value> &root);
+
+std::ostream &operator<<(std::ostream &os, const GraphStats &stats);
+
+/**
+ * Process-wide counts of Value objects, on every thread, wherever they were allocated. To watch a training step, call
+ * reset_peak_live_values() before it and read peak_live_values() after; live_values() going up from step to step
+ * means graphs are leaking (e.g. a loss kept around, or a cycle of shared_ptrs).
+ */
+size_t live_values();
+size_t peak_live_values();
+void reset_peak_live_values(); // restarts the peak from the current live count
@@ -1,6 +1,21 @@
 #include "autograd.h"
 #include "vis.h"
 #include "network.h"
+#include "arena.h"
+#include "tape.h"
+#include "compiled.h"
+#include "optimize.h"
+#include "parallel.h"
+#include "optimizer.h"
+#include "dataset.h"
+#include "csv.h"
+#include "checkpoint.h"
+#include "profiler.h"
+#include "graph_stats.h"
+#include "static_network.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 using namespace operation; 
 
 int main()
@@ -60,9 +75,33 @@ int main()
     auto out = (exp(2 * n) - 1) / (exp(2 * n) + 1);
     out -> set_label("out");
 
+    // both exp(2 * n) collapse into one node, and the duplicated 2s and 1s into one constant each
+    auto optimized = optimize_graph(out);
+    std::cout << "Optimized tanh graph: " << optimized.nodes_before << " -> " << optimized.nodes_after << " nodes ("
+              << optimized.folded << " folded, " << optimized.interned << " constants interned, " << optimized.merged << " merged)" << std::endl;
+
+    // the optimized graph computes the same output, and backward on it gives the leaves the same grads
+    network_output_t leaves{x1, x2, w1, w2, bias};
+    optimized.root->backward();
+    std::vector<float> optimized_grads;
+    for (const auto& leaf : leaves) {
+      optimized_grads.push_back(leaf->get_grad());
+      leaf->set_grad(0.0f);
+    }
+
     // backprop for the fixed values
     out->backward();
 
+    float max_diff = std::abs(optimized.root->get_data() - out->get_data());
+    for (size_t i = 0; i < leaves.size(); i++) {
+      max_diff = std::max(max_diff, std::abs(leaves[i]->get_grad() - optimized_grads[i]));
+    }
+    auto commuted = optimize_graph(x1 * w1 + w1 * x1); // the product in either order is one node
+    std::cout << "Optimized vs original graph, max difference: " << max_diff << ", commuted products merged: " << commuted.merged << std::endl;
+    if (max_diff > 1e-6f || commuted.merged != 1) {
+      throw std::runtime_error("optimized graph differs from the original");
+    }
+
     WRITE_PNG(out, "neuron_comp_graph_no_tanh.png");   // produces graph.png
     }
     // test case where we reuse dependency, grad should be 2
@@ -97,6 +136,26 @@ int main()
       outputs[0]->backward();
       WRITE_PNG(outputs[0], "fcc_network_comp_graph.png");
 
+      // inference without a graph, straight from the parameter buffers
+      std::vector<float> x = {1.0f, 0.0f, -1.0f};
+      float prediction = 0.0f;
+      net.predict(x, std::span<float>(&prediction, 1));
+      std::cout << "Graph output: " << outputs[0]->get_data() << ", predict(): " << prediction << std::endl;
+
+      size_t n_calls = 100000;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < n_calls; i++) {
+        x[0] = i * 1e-5f;
+        net.predict(x, std::span<float>(&prediction, 1));
+      }
+      std::chrono::duration<double, std::nano> predict_time = std::chrono::steady_clock::now() - start;
+      start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < n_calls / 10; i++) {
+        inputs[0]->set_data(i * 1e-5f);
+        prediction = net(inputs)[0]->get_data();
+      }
+      std::chrono::duration<double, std::nano> graph_time = std::chrono::steady_clock::now() - start;
+      std::cout << "Latency per forward pass: predict() " << predict_time.count() / n_calls << " ns, graph " << graph_time.count() / (n_calls / 10) << " ns" << std::endl;
     }
     // compute loss over a batch and backpropagate
     {
@@ -121,7 +180,12 @@ int main()
       size_t n_steps = N_EPOCHS;
       float learning_rate = LEARNING_RATE;
       Optimizer opt(net.trainable_parameters(), learning_rate);
+      GraphArena arena; // every step's graph lives here, parameters stay on the heap
+      Tape tape;        // records nodes in creation order, so backward doesn't need to sort the graph
       for (size_t i = 0 ; i < n_steps; i++) {
+        {
+        ArenaScope scope(arena);
+        RecordingScope recording(tape);
 
         auto outputs = net(X);
         std::shared_ptr<Value> loss = make_value(0.0, "loss");
@@ -142,7 +206,10 @@ int main()
         if (i%5 == 0 || i == n_steps - 1) {
           WRITE_PNG(loss, "fcc_trained_network_after_step[" + std::to_string(i) + "].png");
         }
+        } // graph for this step is dropped here, so the arena can be reused
+        arena.reset();
       } 
+      std::cout << "Graph arena high-water mark: " << arena.high_water_mark() << " bytes in " << arena.block_count() << " block(s)" << std::endl;
 
       // final predictions after training
       auto final_outputs = net(X);
@@ -154,7 +221,792 @@ int main()
 
     }
 
-    
+    // labels of nodes built in an arena are kept in the arena's own table, the others in the shared one
+    {
+      bool was_recording = recording_labels();
+      set_record_labels(true);
+      auto heap_node = make_value(1.0f, "heap");
+      GraphArena arena;
+      bool arena_labels;
+      {
+        ArenaScope scope(arena);
+        auto a = make_value(2.0f, "a");
+        auto b = a * heap_node;
+        b->set_label("a * heap");
+        arena_labels = a->get_label() == "a" && b->get_label() == "a * heap";
+      }
+      arena.reset();
+      set_record_labels(was_recording);
+      bool heap_labels = heap_node->get_label() == "heap";
+      std::cout << "Labels in an arena: " << arena_labels << ", on the heap: " << heap_labels << std::endl;
+      if (!arena_labels || !heap_labels) {
+        throw std::runtime_error("labels lost");
+      }
+    }
+
+    // backward on a tape only goes through its root's graph: nodes dropped while building it, outputs the loss doesn't
+    // use and the graph of an earlier backward in the same scope are skipped, and must give the same grads as the sort
+    {
+      FullyConnectedNetwork net(3, {4,2});
+      std::array<std::shared_ptr<Value>, 3> x = {make_value(0.5f), make_value(-1.0f), make_value(2.0f)};
+      auto partial_loss = [&]() {
+        {
+          auto unused = x[0] * x[1]; // recorded, then dropped before backward
+        }
+        auto out = net(x)[0]; // the vector holding the second output is dropped here
+        return out * out;
+      };
+      const auto& params = net.trainable_parameters();
+      net.parameter_store().zero_grad();
+      partial_loss()->backward();
+      std::vector<float> sorted_grads(net.parameter_store().grad().begin(), net.parameter_store().grad().end());
+
+      GraphArena arena;
+      Tape tape;
+      net.parameter_store().zero_grad();
+      float second_grad;
+      {
+        ArenaScope scope(arena);
+        RecordingScope recording(tape);
+        partial_loss()->backward();
+
+        // a second graph in the same scope, using only the first weight: d(w + 1)/dw = 1
+        auto w = params[0];
+        float first_grad = w->get_grad();
+        auto l2 = w + 1.0f;
+        l2->backward();
+        second_grad = w->get_grad() - first_grad;
+      }
+      arena.reset();
+      float max_diff = 0.0f;
+      for (size_t i = 0; i < params.size(); i++) {
+        max_diff = std::max(max_diff, std::abs(net.parameter_store().grad()[i] - sorted_grads[i] - (i == 0 ? second_grad : 0.0f)));
+      }
+      std::cout << "Taped backward with dropped nodes vs sorted, max grad difference: " << max_diff << ", second backward's grad: " << second_grad << std::endl;
+      if (max_diff > 1e-6f || second_grad != 1.0f) {
+        throw std::runtime_error("Taped backward doesn't match the sorted one");
+      }
+    }
+
+    // same training problem, with the batch sharded across threads
+    {
+      FullyConnectedNetwork net(3, {4,4,1});
+
+      std::array<std::shared_ptr<Value>, 3> x1_arr = {make_value(1.0), make_value(0.0), make_value(-1.0)};
+      std::array<std::shared_ptr<Value>, 3> x2_arr = {make_value(0.0), make_value(1.0), make_value(2.0)};
+      std::array<std::shared_ptr<Value>, 3> x3_arr = {make_value(-1.0), make_value(-1.0), make_value(1.0)};
+      std::vector<network_input_t> X{x1_arr, x2_arr, x3_arr};
+      std::vector<float> expected_outputs = {1.0f, -1.0f, 0.0f};
+
+      DataParallel data_parallel(net);
+      Optimizer opt(net.trainable_parameters(), LEARNING_RATE);
+      for (size_t i = 0; i < N_EPOCHS; i++) {
+        opt.zero_grad();
+        float loss = data_parallel.forward_backward(X, [&](const network_output_t& outputs, size_t sample) {
+          auto diff = outputs[0] - expected_outputs[sample];
+          return diff * diff;
+        });
+        opt.step();
+        if (i%10 == 0 || i == N_EPOCHS - 1) {
+          std::cout << "Data parallel step " << i << " (" << data_parallel.num_threads() << " threads), loss: " << loss << std::endl;
+        }
+      }
+
+      // a loss that ignores the second output: same grads as a plain backward of the summed loss on one thread
+      FullyConnectedNetwork two_outputs(3, {4, 2});
+      DataParallel two_outputs_parallel(two_outputs, 3); // one shard per sample, whatever the core count
+      auto first_output_loss = [&](const network_output_t& outputs, size_t sample) {
+        auto diff = outputs[0] - expected_outputs[sample];
+        return diff * diff;
+      };
+      two_outputs_parallel.forward_backward(X, first_output_loss);
+      auto grads = two_outputs.parameter_store().grad();
+      std::vector<float> parallel_grads(grads.begin(), grads.end());
+
+      two_outputs.parameter_store().zero_grad();
+      auto total_loss = first_output_loss(two_outputs(X[0]), 0);
+      for (size_t sample = 1; sample < X.size(); sample++) {
+        total_loss = total_loss + first_output_loss(two_outputs(X[sample]), sample);
+      }
+      total_loss->backward();
+      float max_diff = 0.0f;
+      for (size_t i = 0; i < grads.size(); i++) {
+        max_diff = std::max(max_diff, std::abs(grads[i] - parallel_grads[i]));
+      }
+      std::cout << "Data parallel with an unused output vs one thread, max grad difference: " << max_diff << std::endl;
+      if (max_diff > 1e-5f) {
+        throw std::runtime_error("data parallel grads differ from a single-threaded backward");
+      }
+    }
+
+    // per-sample SGD on one thread vs Hogwild (lock-free, every thread steps the shared parameters), from the same start
+    {
+      std::vector<std::array<std::shared_ptr<Value>, 3>> x_storage;
+      std::vector<float> targets;
+      for (size_t sample = 0; sample < 256; sample++) {
+        float a = (sample % 16) / 8.0f - 1.0f, b = (sample / 16) / 8.0f - 1.0f;
+        x_storage.push_back({make_value(a), make_value(b), make_value(a * b)});
+        targets.push_back(std::tanh(a - b));
+      }
+      std::vector<network_input_t> X(x_storage.begin(), x_storage.end());
+      auto loss_fn = [&](const network_output_t& outputs, size_t sample) {
+        auto diff = outputs[0] - targets[sample];
+        return diff * diff;
+      };
+      size_t n_epochs = 20;
+
+      FullyConnectedNetwork sync_net(3, {8,8,1});
+      FullyConnectedNetwork hogwild_net = sync_net.clone();
+
+      auto start = std::chrono::steady_clock::now();
+      Optimizer opt(sync_net.trainable_parameters(), LEARNING_RATE);
+      GraphArena arena;
+      Tape tape;
+      float sync_loss = 0.0f;
+      for (size_t epoch = 0; epoch < n_epochs; epoch++) {
+        sync_loss = 0.0f;
+        for (size_t sample = 0; sample < X.size(); sample++) {
+          {
+          ArenaScope scope(arena);
+          RecordingScope recording(tape);
+          auto loss = loss_fn(sync_net(X[sample]), sample);
+          sync_loss += loss->get_data();
+          opt.zero_grad();
+          loss->backward();
+          opt.step();
+          }
+          arena.reset();
+        }
+      }
+      std::chrono::duration<double> sync_time = std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      Hogwild hogwild(hogwild_net, LEARNING_RATE);
+      float hogwild_loss = 0.0f;
+      for (size_t epoch = 0; epoch < n_epochs; epoch++) {
+        hogwild_loss = hogwild.train_epoch(X, loss_fn);
+      }
+      std::chrono::duration<double> hogwild_time = std::chrono::steady_clock::now() - start;
+
+      double n_samples = double(n_epochs * X.size());
+      std::cout << "Synchronous SGD: last epoch loss " << sync_loss << ", " << n_samples / sync_time.count() << " samples/s" << std::endl;
+      std::cout << "Hogwild SGD (" << hogwild.num_threads() << " threads): last epoch loss " << hogwild_loss << ", " << n_samples / hogwild_time.count() << " samples/s" << std::endl;
+
+      // on one thread, with a loss that ignores the second output, Hogwild is plain per-sample SGD
+      FullyConnectedNetwork two_outputs(3, {4, 2});
+      FullyConnectedNetwork two_outputs_sgd = two_outputs.clone();
+      Hogwild(two_outputs, LEARNING_RATE, 1).train_epoch(X, loss_fn);
+      Optimizer sgd(two_outputs_sgd.trainable_parameters(), LEARNING_RATE);
+      for (size_t sample = 0; sample < X.size(); sample++) {
+        auto loss = loss_fn(two_outputs_sgd(X[sample]), sample);
+        sgd.zero_grad();
+        loss->backward();
+        sgd.step();
+      }
+      float max_diff = 0.0f;
+      auto hogwild_params = two_outputs.parameter_store().data();
+      auto sgd_params = two_outputs_sgd.parameter_store().data();
+      for (size_t i = 0; i < hogwild_params.size(); i++) {
+        max_diff = std::max(max_diff, std::abs(hogwild_params[i] - sgd_params[i]));
+      }
+      std::cout << "Hogwild with an unused output vs per-sample SGD on one thread, max parameter difference: " << max_diff << std::endl;
+      if (max_diff > 1e-5f) {
+        throw std::runtime_error("Hogwild parameters differ from per-sample SGD");
+      }
+    }
+
+    // backward over one big graph with nodes of the same level processed in parallel, checked against the serial one.
+    // 96 neurons per layer puts more than MIN_PARALLEL_LEVEL_SIZE nodes in a level, so the pool is really used
+    {
+      FullyConnectedNetwork net(3, {96,96,1});
+      // a fresh graph for each backward, since both accumulate into the grads of intermediate nodes
+      auto build_loss = [&net]() {
+        std::shared_ptr<Value> loss = make_value(0.0, "loss");
+        for (size_t sample = 0; sample < 64; sample++) {
+          std::array<std::shared_ptr<Value>, 3> x = {make_value(sample * 0.1f), make_value(1.0f - sample * 0.05f), make_value(0.5f)};
+          auto diff = net(x)[0] - (sample % 2 ? 1.0f : -1.0f);
+          loss = loss + (diff * diff);
+        }
+        return loss;
+      };
+
+      const auto &params = net.trainable_parameters();
+      Optimizer opt(params, LEARNING_RATE);
+      opt.zero_grad();
+      build_loss()->backward();
+      std::vector<float> serial_grads;
+      for (const auto &p : params) {
+        serial_grads.push_back(p->get_grad());
+      }
+
+      ThreadPool pool(4); // whatever the core count
+      opt.zero_grad();
+      parallel_backward(build_loss(), pool);
+      float max_diff = 0.0f, max_grad = 0.0f;
+      for (size_t i = 0; i < params.size(); i++) {
+        max_diff = std::max(max_diff, std::abs(params[i]->get_grad() - serial_grads[i]));
+        max_grad = std::max(max_grad, std::abs(serial_grads[i]));
+      }
+      std::cout << "Parallel backward (" << pool.size() << " threads) vs serial, max grad difference: " << max_diff << " (largest grad " << max_grad << ")" << std::endl;
+      // the atomic adds sum in a different order, so allow for rounding relative to the size of the grads
+      if (max_diff > 1e-5f * std::max(1.0f, max_grad)) {
+        throw std::runtime_error("parallel backward grads differ from the serial backward");
+      }
+    }
+
+    // same training problem, but the graph is traced once and replayed every step
+    {
+      FullyConnectedNetwork net(3, {4,4,1});
+
+      // one step's graph, built from input Values that get new data on every replay
+      network_output_t inputs;
+      network_output_t targets;
+      std::shared_ptr<Value> loss = make_value(0.0, "loss");
+      for (size_t sample = 0; sample < 3; sample++) {
+        network_output_t x;
+        for (size_t j = 0; j < 3; j++) {
+          x.push_back(make_value(0.0));
+        }
+        auto target = make_value(0.0);
+        auto diff = net(x)[0] - target;
+        loss = loss + (diff * diff);
+        inputs.insert(inputs.end(), x.begin(), x.end());
+        inputs.push_back(target);
+      }
+      network_output_t outputs{loss};
+      CompiledGraph plan(outputs, inputs);
+
+      // x1, x2, x3 followed by the expected output, per sample
+      std::vector<float> batch = {
+        1.0f, 0.0f, -1.0f, 1.0f,
+        0.0f, 1.0f, 2.0f, -1.0f,
+        -1.0f, -1.0f, 1.0f, 0.0f
+      };
+
+      Optimizer opt(net.trainable_parameters(), LEARNING_RATE);
+      for (size_t i = 0; i < N_EPOCHS; i++) {
+        plan.forward(batch);
+        opt.zero_grad();
+        plan.backward();
+        opt.step();
+        if (i%10 == 0 || i == N_EPOCHS - 1) {
+          std::cout << "Compiled step " << i << ", loss: " << plan.output(0) << std::endl;
+        }
+      }
+      std::cout << "Compiled plan: " << plan.num_instructions() << " instructions over " << plan.num_slots() << " slots" << std::endl;
+    }
+
+    // an operation defined outside the library with just forward and backward: fine in graphs, refused by CompiledGraph
+    {
+      struct Square : Operation {
+        std::shared_ptr<Value> forward(std::span<std::shared_ptr<Value> const> inputs) const override {
+          return make_node(inputs[0]->get_data() * inputs[0]->get_data(), inputs, shared_from_this());
+        }
+        void backward(std::span<std::shared_ptr<Value> const> inputs, const Value& out) const override {
+          inputs[0]->add_grad(2.0f * inputs[0]->get_data() * out.get_grad());
+        }
+        std::string get_name() const override { return "square"; }
+      };
+
+      auto x = make_value(3.0f);
+      network_output_t operands{x};
+      auto y = std::make_shared<Square>()->forward(operands) + x;
+      y->backward();
+
+      bool refused = false;
+      try {
+        network_output_t outputs{y};
+        CompiledGraph plan(outputs, operands);
+      } catch (const std::invalid_argument&) {
+        refused = true;
+      }
+      std::cout << "Custom operation without kernels, grad: " << x->get_grad() << ", compile refused: " << refused << std::endl;
+      if (x->get_grad() != 7.0f || !refused) {
+        throw std::runtime_error("custom operation without kernels mishandled");
+      }
+    }
+
+    // a custom operation may build a node without operands, and backward(false) turns released nodes into leaves
+    {
+      struct Source : Operation {
+        std::shared_ptr<Value> forward(std::span<std::shared_ptr<Value> const> inputs) const override {
+          return make_node(2.0f, inputs, shared_from_this());
+        }
+        void backward(std::span<std::shared_ptr<Value> const>, const Value&) const override {}
+        std::string get_name() const override { return "source"; }
+      };
+
+      auto x = make_value(3.0f);
+      auto y = std::make_shared<Source>()->forward({}) * x;
+      y->backward(false);
+      bool released = y->get_operation() == nullptr && y->get_prev().empty();
+      y->backward(); // just a leaf now
+      std::cout << "Operation without operands, grad: " << x->get_grad() << ", released node is a leaf: " << released << std::endl;
+      if (x->get_grad() != 2.0f || !released) {
+        throw std::runtime_error("operation without operands mishandled");
+      }
+    }
+
+    // same training problem through the tensor path: one matmul per layer for the whole batch
+    {
+      FullyConnectedNetwork net(3, {4,4,1});
+
+      auto X = make_tensor(3, 3, {
+        1.0f, 0.0f, -1.0f,
+        0.0f, 1.0f, 2.0f,
+        -1.0f, -1.0f, 1.0f
+      });
+      auto expected = make_tensor(3, 1, {1.0f, -1.0f, 0.0f});
+
+      Optimizer opt(net.trainable_parameters(), LEARNING_RATE);
+      for (size_t i = 0; i < N_EPOCHS; i++) {
+        auto diff = net(X) - expected;
+        auto loss = sum(diff * diff);
+
+        opt.zero_grad();
+        loss->backward(); // grads flow back into the scalar parameters
+        opt.step();
+        if (i%10 == 0 || i == N_EPOCHS - 1) {
+          std::cout << "Tensor step " << i << ", loss: " << loss->get_data()[0] << std::endl;
+        }
+      }
+      std::cout << "Final tensor outputs: " << net(X) << std::endl;
+    }
+
+    // same training problem with each optimizer, from the same starting parameters
+    {
+      FullyConnectedNetwork initial(3, {4,4,1});
+      auto X = make_tensor(3, 3, {
+        1.0f, 0.0f, -1.0f,
+        0.0f, 1.0f, 2.0f,
+        -1.0f, -1.0f, 1.0f
+      });
+      auto expected = make_tensor(3, 1, {1.0f, -1.0f, 0.0f});
+
+      auto train = [&](const std::string& name, FullyConnectedNetwork& net, auto& opt) {
+        float final_loss = 0.0f;
+        for (size_t i = 0; i < N_EPOCHS; i++) {
+          auto diff = net(X) - expected;
+          auto loss = sum(diff * diff);
+          opt.zero_grad();
+          loss->backward();
+          opt.step();
+          final_loss = loss->get_data()[0];
+        }
+        std::cout << name << ": loss after " << N_EPOCHS << " steps: " << final_loss << std::endl;
+      };
+
+      auto sgd_net = initial.clone();
+      Optimizer sgd(sgd_net.trainable_parameters(), LEARNING_RATE);
+      train("SGD", sgd_net, sgd);
+      auto momentum_net = initial.clone();
+      SGDMomentum momentum(momentum_net.parameter_store(), LEARNING_RATE, 0.9f);
+      train("SGD + momentum", momentum_net, momentum);
+      auto nesterov_net = initial.clone();
+      SGDMomentum nesterov(nesterov_net.parameter_store(), LEARNING_RATE, 0.9f, true);
+      train("Nesterov", nesterov_net, nesterov);
+      auto adam_net = initial.clone();
+      Adam adam(adam_net.parameter_store(), 0.05f);
+      train("Adam", adam_net, adam);
+      auto adamw_net = initial.clone();
+      AdamW adamw(adamw_net.parameter_store(), 0.05f);
+      train("AdamW", adamw_net, adamw);
+
+      // cost of the update alone, on a bigger network (grads are left at whatever they are, only the pass matters)
+      FullyConnectedNetwork big(32, {256,256,1});
+      size_t n_steps = 1000;
+      auto time_steps = [&](const std::string& name, auto& opt) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n_steps; i++) {
+          opt.step();
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << " update: " << elapsed.count() / n_steps << " ns/step for " << big.trainable_parameters().size() << " parameters" << std::endl;
+      };
+      Optimizer big_sgd(big.trainable_parameters(), 1e-6f);
+      time_steps("SGD", big_sgd);
+      SGDMomentum big_momentum(big.parameter_store(), 1e-6f);
+      time_steps("SGD + momentum", big_momentum);
+      Adam big_adam(big.parameter_store(), 1e-6f);
+      time_steps("Adam", big_adam);
+    }
+
+    // training from a memory-mapped dataset file, in shuffled mini-batches
+    {
+      std::string path = (std::filesystem::temp_directory_path() / "micrograd_example_dataset.bin").string();
+      std::vector<float> rows; // a, b, a * b -> tanh(a - b)
+      for (size_t i = 0; i < 4096; i++) {
+        float a = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+        float b = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+        rows.insert(rows.end(), {a, b, a * b, std::tanh(a - b)});
+      }
+      write_dataset(path, 3, 1, rows);
+
+      Dataset dataset(path);
+      DataLoader loader(dataset, 64, true);
+      FullyConnectedNetwork net(3, {8,8,1});
+      Adam opt(net.parameter_store(), 0.01f);
+      for (size_t epoch = 0; epoch < 5; epoch++) {
+        float epoch_loss = 0.0f;
+        while (auto batch = loader.next()) {
+          // the batch itself is read in place, the tensor path wants its own buffers
+          std::vector<float> x, y;
+          for (size_t k = 0; k < batch->size(); k++) {
+            x.insert(x.end(), batch->features(k).begin(), batch->features(k).end());
+            y.insert(y.end(), batch->targets(k).begin(), batch->targets(k).end());
+          }
+          auto diff = net(make_tensor(batch->size(), 3, std::move(x))) - make_tensor(batch->size(), 1, std::move(y));
+          auto loss = sum(diff * diff);
+          opt.zero_grad();
+          loss->backward();
+          opt.step();
+          epoch_loss += loss->get_data()[0];
+        }
+        loader.start_epoch();
+        std::cout << "Dataset epoch " << epoch << " (" << loader.batches_per_epoch() << " batches of " << dataset.rows() << " rows), mean loss: " << epoch_loss / dataset.rows() << std::endl;
+      }
+      std::filesystem::remove(path);
+    }
+
+    // CSV ingestion: converted to the dataset format in parallel, or streamed straight into training
+    {
+      std::string csv_path = (std::filesystem::temp_directory_path() / "micrograd_example.csv").string();
+      std::string dataset_path = (std::filesystem::temp_directory_path() / "micrograd_example_from_csv.bin").string();
+      {
+        std::ofstream csv(csv_path);
+        csv << "a,b,ab,target\n";
+        for (size_t i = 0; i < 100000; i++) {
+          float a = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+          float b = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+          csv << a << "," << b << "," << a * b << "," << std::tanh(a - b) << "\n";
+        }
+      }
+
+      CsvStats stats = convert_csv(csv_path, dataset_path);
+      Dataset dataset(dataset_path);
+      std::cout << "Converted " << stats.rows << " CSV rows (" << stats.bytes << " bytes) at " << stats.gb_per_second() << " GB/s, dataset has "
+                << dataset.rows() << " rows of " << dataset.num_features() << " features" << std::endl;
+
+      // one pass over the CSV, parsing a batch at a time right before it is used
+      CsvStream stream(csv_path);
+      FullyConnectedNetwork net(3, {8,8,1});
+      Adam opt(net.parameter_store(), 0.01f);
+      size_t batch_size = 256;
+      float pass_loss = 0.0f;
+      for (auto rows = stream.next_rows(batch_size); !rows.empty(); rows = stream.next_rows(batch_size)) {
+        size_t n = rows.size() / stream.num_columns();
+        std::vector<float> x, y;
+        for (size_t k = 0; k < n; k++) {
+          auto row = rows.subspan(k * stream.num_columns(), stream.num_columns());
+          x.insert(x.end(), row.begin(), row.begin() + stream.num_features());
+          y.insert(y.end(), row.begin() + stream.num_features(), row.end());
+        }
+        auto diff = net(make_tensor(n, 3, std::move(x))) - make_tensor(n, 1, std::move(y));
+        auto loss = sum(diff * diff);
+        opt.zero_grad();
+        loss->backward();
+        opt.step();
+        pass_loss += loss->get_data()[0];
+      }
+      std::cout << "Streamed " << stream.stats().rows << " CSV rows into training (parsing at " << stream.stats().gb_per_second()
+                << " GB/s), mean loss: " << pass_loss / stream.stats().rows << std::endl;
+
+      std::filesystem::remove(csv_path);
+      std::filesystem::remove(dataset_path);
+    }
+
+    // checkpoints: save a trained network with its optimizer state, reload it, or run it straight from the mapped file
+    {
+      std::string path = (std::filesystem::temp_directory_path() / "micrograd_example_checkpoint.bin").string();
+      std::string async_path = (std::filesystem::temp_directory_path() / "micrograd_example_checkpoint_async.bin").string();
+      FullyConnectedNetwork net(3, {8,8,1}, {Activation::ReLU, Activation::Tanh, Activation::Tanh});
+      Adam opt(net.parameter_store(), 0.01f);
+      auto X = make_tensor(3, 3, {
+        1.0f, 0.0f, -1.0f,
+        0.0f, 1.0f, 2.0f,
+        -1.0f, -1.0f, 1.0f
+      });
+      auto expected = make_tensor(3, 1, {1.0f, -1.0f, 0.0f});
+      auto train_step = [&](FullyConnectedNetwork& n, Adam& o) {
+        auto diff = n(X) - expected;
+        auto loss = sum(diff * diff);
+        o.zero_grad();
+        loss->backward();
+        o.step();
+      };
+      for (size_t i = 0; i < N_EPOCHS; i++) {
+        train_step(net, opt);
+      }
+
+      save_checkpoint(path, net, &opt);
+      // the async save only snapshots the buffers here, training goes on while the file is written
+      auto pending = save_checkpoint_async(async_path, net, &opt);
+      pending.get();
+
+      auto loaded = load_network(path);
+      MappedNetwork mapped(async_path);
+      std::vector<float> x{0.5f, -0.25f, 1.0f};
+      std::cout << "Checkpoint of " << net.trainable_parameters().size() << " parameters (" << std::filesystem::file_size(path)
+                << " bytes), prediction: original " << net.predict(x)[0] << ", loaded " << loaded.predict(x)[0] << ", mapped " << mapped.predict(x)[0] << std::endl;
+
+      // resuming training from the checkpoint continues exactly where the original left off
+      Adam resumed_opt(loaded.parameter_store(), 0.01f);
+      load_optimizer_state(path, resumed_opt);
+      train_step(net, opt);
+      train_step(loaded, resumed_opt);
+      std::cout << "After one more step: original " << net.predict(x)[0] << ", resumed " << loaded.predict(x)[0] << std::endl;
+
+      std::filesystem::remove(path);
+      std::filesystem::remove(async_path);
+    }
+
+    // what the graph of a training step is made of, and checking that nothing outlives the step
+    {
+      FullyConnectedNetwork net(16, {32,32,1});
+      Optimizer opt(net.trainable_parameters(), LEARNING_RATE);
+      std::vector<std::shared_ptr<Value>> inputs;
+      for (size_t i = 0; i < 8 * 16; i++) {
+        inputs.push_back(make_value(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1));
+      }
+      std::vector<network_input_t> X;
+      for (size_t i = 0; i < 8; i++) {
+        X.push_back(network_input_t(inputs).subspan(i * 16, 16));
+      }
+
+      size_t live_before = live_values();
+      for (size_t step = 0; step < 3; step++) {
+        reset_peak_live_values();
+        {
+          auto outputs = net(X);
+          std::shared_ptr<Value> loss = make_value(0.0f, "loss");
+          for (const auto& out : outputs) {
+            loss = loss + out[0] * out[0];
+          }
+          if (step == 0) {
+            std::cout << "Graph of one step: " << graph_stats(loss) << std::endl;
+          }
+          opt.zero_grad();
+          loss->backward();
+          opt.step();
+        }
+        std::cout << "Step " << step << ": peak " << peak_live_values() << " live Values, " << live_values() << " after the step ("
+                  << live_before << " before)" << std::endl;
+      }
+    }
+
+    // gradient checkpointing on a deep network: same grads as the plain backward, with a fraction of the graph alive at once
+    {
+      size_t batch_size = 16, n_inputs = 16;
+      FullyConnectedNetwork net(n_inputs, {64,64,64,64,64,64,64,64,1});
+      std::vector<std::shared_ptr<Value>> inputs;
+      std::vector<float> targets;
+      for (size_t i = 0; i < batch_size * n_inputs; i++) {
+        inputs.push_back(make_value(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1));
+      }
+      std::vector<network_input_t> X;
+      for (size_t i = 0; i < batch_size; i++) {
+        X.push_back(network_input_t(inputs).subspan(i * n_inputs, n_inputs));
+        targets.push_back(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1);
+      }
+      auto loss_fn = [&](const network_output_t& out, size_t i) {
+        auto diff = out[0] - targets[i];
+        return diff * diff;
+      };
+      const auto& params = net.trainable_parameters();
+      Optimizer opt(params, LEARNING_RATE);
+
+      opt.zero_grad();
+      reset_peak_live_values();
+      float plain_loss;
+      {
+        auto outputs = net(X);
+        auto loss = loss_fn(outputs[0], 0);
+        for (size_t i = 1; i < batch_size; i++) {
+          loss = loss + loss_fn(outputs[i], i);
+        }
+        loss->backward();
+        plain_loss = loss->get_data();
+      }
+      size_t plain_peak = peak_live_values() - live_values();
+      std::vector<float> plain_grads;
+      for (const auto& p : params) {
+        plain_grads.push_back(p->get_grad());
+      }
+
+      opt.zero_grad();
+      reset_peak_live_values();
+      float checkpointed_loss = net.checkpointed_forward_backward(X, loss_fn);
+      size_t checkpointed_peak = peak_live_values() - live_values();
+      float max_diff = 0.0f, max_grad = 0.0f;
+      for (size_t i = 0; i < params.size(); i++) {
+        max_diff = std::max(max_diff, std::abs(params[i]->get_grad() - plain_grads[i]));
+        max_grad = std::max(max_grad, std::abs(plain_grads[i]));
+      }
+      std::cout << "Checkpointed backward over " << net.get_layer_widths().size() - 1 << " layers: loss " << checkpointed_loss << " (plain " << plain_loss
+                << "), max grad difference " << max_diff << " (largest grad " << max_grad << "), peak graph nodes " << checkpointed_peak << " (plain " << plain_peak << ")" << std::endl;
+
+      // a second output that the loss ignores, with one or two layers per segment, while the caller records on a tape
+      FullyConnectedNetwork two_outputs(n_inputs, {16, 16, 16, 2});
+      const auto& two_outputs_params = two_outputs.trainable_parameters();
+      Optimizer two_outputs_opt(two_outputs_params, LEARNING_RATE);
+      two_outputs_opt.zero_grad();
+      {
+        auto outputs = two_outputs(X);
+        auto loss = loss_fn(outputs[0], 0);
+        for (size_t i = 1; i < batch_size; i++) {
+          loss = loss + loss_fn(outputs[i], i);
+        }
+        loss->backward();
+      }
+      std::vector<float> two_outputs_grads;
+      for (const auto& p : two_outputs_params) {
+        two_outputs_grads.push_back(p->get_grad());
+      }
+      float partial_diff = 0.0f;
+      Tape caller_tape;
+      for (size_t layers_per_segment : {1, 2}) {
+        two_outputs_opt.zero_grad();
+        RecordingScope recording(caller_tape);
+        two_outputs.checkpointed_forward_backward(X, loss_fn, layers_per_segment);
+        for (size_t i = 0; i < two_outputs_params.size(); i++) {
+          partial_diff = std::max(partial_diff, std::abs(two_outputs_params[i]->get_grad() - two_outputs_grads[i]));
+        }
+      }
+      std::cout << "Checkpointed backward with an unused output, max grad difference " << partial_diff << std::endl;
+      if (partial_diff > 1e-5f) {
+        throw std::runtime_error("checkpointed grads differ from the plain backward when an output is unused");
+      }
+    }
+
+    // long graphs are sorted and freed without recursion, and backward(false) frees the graph as it goes
+    {
+      auto x = make_value(1.0f);
+      auto sum = x;
+      for (size_t i = 0; i < 1000000; i++) {
+        sum = sum + x; // a chain a million nodes deep
+      }
+      auto start = std::chrono::steady_clock::now();
+      size_t n_sorted = topo_sort(sum).size();
+      std::chrono::duration<double, std::milli> sort_time = std::chrono::steady_clock::now() - start;
+      start = std::chrono::steady_clock::now();
+      sum.reset();
+      std::chrono::duration<double, std::milli> teardown = std::chrono::steady_clock::now() - start;
+      std::cout << "Sorted a chain of " << n_sorted << " nodes in " << sort_time.count() << " ms, freed it in " << teardown.count() << " ms" << std::endl;
+
+      FullyConnectedNetwork net(16, {32,32,1});
+      std::vector<std::shared_ptr<Value>> inputs;
+      for (size_t i = 0; i < 8 * 16; i++) {
+        inputs.push_back(make_value(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1));
+      }
+      std::vector<network_input_t> X;
+      for (size_t i = 0; i < 8; i++) {
+        X.push_back(network_input_t(inputs).subspan(i * 16, 16));
+      }
+      for (bool retain_graph : {true, false}) {
+        std::shared_ptr<Value> loss = make_value(0.0f);
+        for (const auto& out : net(X)) {
+          loss = loss + out[0] * out[0];
+        }
+        size_t live_before = live_values();
+        loss->backward(retain_graph);
+        std::cout << "backward(" << (retain_graph ? "true" : "false") << "): " << live_before << " live Values before, " << live_values() << " after" << std::endl;
+      }
+    }
+
+    // a network whose shape is fixed at compile time: no graph, no size checks and no allocation in a training step
+    {
+      using StaticNet = StaticFCNetwork<3, 4, 4, 1>;
+      srand(7);
+      FullyConnectedNetwork graph_net(3, {4,4,1});
+      srand(7);
+      StaticNet static_net; // same parameters as graph_net
+      std::array<StaticNet::input_t, 3> xs{{{1.0f, 0.0f, -1.0f}, {0.0f, 1.0f, 2.0f}, {-1.0f, -1.0f, 1.0f}}};
+      std::array<StaticNet::output_t, 3> ys{{{1.0f}, {-1.0f}, {0.0f}}};
+      std::cout << "Same start: graph network predicts " << graph_net.predict(xs[0])[0] << ", StaticFCNetwork " << static_net.predict(xs[0])[0] << std::endl;
+
+      size_t n_steps = 2000;
+      Adam static_opt(static_net.parameter_data(), static_net.parameter_grads(), 0.01f);
+      float static_loss = 0.0f;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t step = 0; step < n_steps; step++) {
+        static_opt.zero_grad();
+        static_loss = 0.0f;
+        for (size_t i = 0; i < xs.size(); i++) {
+          static_loss += static_net.forward_backward(xs[i], ys[i]);
+        }
+        static_opt.step();
+      }
+      std::chrono::duration<double, std::micro> static_time = std::chrono::steady_clock::now() - start;
+
+      // the same training through graphs of Values, in an arena and on a tape
+      Adam graph_opt(graph_net.parameter_store(), 0.01f);
+      std::vector<std::shared_ptr<Value>> x_values;
+      for (const auto& x : xs) {
+        for (float v : x) {
+          x_values.push_back(make_value(v));
+        }
+      }
+      std::vector<network_input_t> X;
+      for (size_t i = 0; i < xs.size(); i++) {
+        X.push_back(network_input_t(x_values).subspan(3 * i, 3));
+      }
+      GraphArena arena;
+      Tape tape;
+      float graph_loss = 0.0f;
+      start = std::chrono::steady_clock::now();
+      for (size_t step = 0; step < n_steps; step++) {
+        {
+          ArenaScope scope(arena);
+          RecordingScope recording(tape);
+          auto outputs = graph_net(X);
+          std::shared_ptr<Value> loss = make_value(0.0f);
+          for (size_t i = 0; i < outputs.size(); i++) {
+            auto diff = outputs[i][0] - ys[i][0];
+            loss = loss + diff * diff;
+          }
+          graph_opt.zero_grad();
+          loss->backward();
+          graph_opt.step();
+          graph_loss = loss->get_data();
+        }
+        arena.reset();
+      }
+      std::chrono::duration<double, std::micro> graph_time = std::chrono::steady_clock::now() - start;
+      std::cout << "Loss after " << n_steps << " Adam steps: StaticFCNetwork " << static_loss << " (" << static_time.count() / n_steps
+                << " us/step), graph " << graph_loss << " (" << graph_time.count() / n_steps << " us/step)" << std::endl;
+    }
+
+    // where the time of a training step goes, per operation and per phase
+    if constexpr (PROFILING) {
+      FullyConnectedNetwork net(16, {32,32,1});
+      Optimizer opt(net.trainable_parameters(), LEARNING_RATE);
+      std::vector<std::shared_ptr<Value>> inputs;
+      for (size_t i = 0; i < 8 * 16; i++) {
+        inputs.push_back(make_value(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1));
+      }
+      std::vector<network_input_t> X;
+      for (size_t i = 0; i < 8; i++) {
+        X.push_back(network_input_t(inputs).subspan(i * 16, 16));
+      }
+
+      profiler::reset();
+      profiler::set_enabled(true);
+      for (size_t step = 0; step < 10; step++) {
+        auto outputs = net(X);
+        std::shared_ptr<Value> loss = make_value(0.0f);
+        for (const auto& out : outputs) {
+          loss = loss + out[0] * out[0];
+        }
+        opt.zero_grad();
+        loss->backward();
+        opt.step();
+      }
+      profiler::set_enabled(false);
+      profiler::print_summary(std::cout);
+      std::string trace_path = (std::filesystem::temp_directory_path() / "micrograd_example_trace.json").string();
+      profiler::write_chrome_trace(trace_path);
+      std::cout << "Chrome trace of the profiled steps written to " << trace_path << " (open it in https://ui.perfetto.dev)" << std::endl;
+    }
 
     return 0;
 }
@@ -0,0 +1,68 @@
+/**
+ * Read-only memory mapping of a whole file.
+ */
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include "mapped_file.h"
+
+MappedFile::MappedFile(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not stat " + path + ": " + std::strerror(errno));
+    }
+    mapping_size = static_cast<size_t>(info.st_size);
+    if (mapping_size == 0)
+    {
+        ::close(fd); // mmap rejects empty mappings, an empty file is just an empty span
+        return;
+    }
+    mapping = ::mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        throw std::runtime_error("Could not mmap " + path + ": " + std::strerror(errno));
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (mapping != nullptr)
+    {
+        ::munmap(mapping, mapping_size);
+    }
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : mapping(std::exchange(other.mapping, nullptr)), mapping_size(std::exchange(other.mapping_size, 0))
+{
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    std::swap(mapping, other.mapping);
+    std::swap(mapping_size, other.mapping_size);
+    return *this;
+}
+
+void MappedFile::advise_random(bool random) const
+{
+    if (mapping != nullptr)
+    {
+        ::madvise(mapping, mapping_size, random ? MADV_RANDOM : MADV_SEQUENTIAL);
+    }
+}
@@ -0,0 +1,31 @@
+/**
+ * Read-only memory mapping of a whole file.
+ */
+#include <cstddef>
+#include <string>
+#pragma once
+
+/**
+ * Maps a file read-only into memory for as long as the object lives. Pages are only read from disk when first
+ * touched, so opening even a huge file is cheap. Used by Dataset and the CSV and checkpoint readers.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    const char *data() const { return static_cast<const char *>(mapping); }
+    size_t size() const { return mapping_size; }
+
+    // hint to the OS about the upcoming access pattern, random disables readahead
+    void advise_random(bool random) const;
+
+private:
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+};
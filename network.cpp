@@ -1,6 +1,11 @@
 // header for building blocks of neural network
 #include "network.h"
+#include "arena.h"
+#include "tape.h"
+#include "profiler.h"
 #include "constants.h"
+#include "simd.h"
+#include <cstring>
 
 
 using namespace operation;
@@ -26,17 +31,23 @@ void print_vector(network_input_t vec, const std::string& name) {
 }
 
 // initialize a neuron that takes in num_inputs inputs
-Neuron::Neuron(int num_inputs, int layer_index, int neuron_index)
+Neuron::Neuron(int num_inputs, int layer_index, int neuron_index, Activation activation) : activation(activation)
 {   
     weights.reserve(num_inputs);
     // initialize weights and bias
+    // labels like L0N3W12 are only built when something will show them (see set_record_labels)
+    std::optional<std::string> prefix;
+    if (recording_labels())
+    {
+        prefix = "L" + std::to_string(layer_index) + "N" + std::to_string(neuron_index);
+    }
     for (int weight_index = 0; weight_index < num_inputs; weight_index++)
     {
         // rand number between -1 and 1
-        auto neuron_label = "L" + std::to_string(layer_index) + "N" + std::to_string(neuron_index) + "W" + std::to_string(weight_index);
-        weights.push_back(make_value(static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1, neuron_label));
+        float w = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+        weights.push_back(make_parameter(w, prefix ? std::optional<std::string>(*prefix + "W" + std::to_string(weight_index)) : std::nullopt));
     }
-    bias = make_value(0.0f, "L" + std::to_string(layer_index) + "N" + std::to_string(neuron_index) + "B");
+    bias = make_parameter(0.0f, prefix ? std::optional<std::string>(*prefix + "B") : std::nullopt);
 }
 
 std::shared_ptr<Value> Neuron::operator()(network_input_t x) const
@@ -53,22 +64,11 @@ std::shared_ptr<Value> Neuron::operator()(network_input_t x) const
 
 
 
-    std::shared_ptr<Value> out = bias;
-    for (size_t i = 0; i < x.size(); i++)
-    {
-        out = (out + ((weights[i]) * (x[i])));
-    }
-
-    DBG(
-        print_value(out, "Output from dot product");
-    );
-
-    // apply tanh activation
-    out = tanh(out);
-
+    // one fused node for the weighted sum and the activation
+    std::shared_ptr<Value> out = linear(weights, x, bias, activation);
 
     DBG(
-        print_value(out, "Output from tanh");
+        print_value(out, "Output from " + activation_name(activation));
     );
     return out;
 };
@@ -91,6 +91,19 @@ const std::vector<std::shared_ptr<Value>> Neuron::trainable_parameters() const
     return out;
 }
 
+Neuron Neuron::clone() const
+{
+    Neuron copy;
+    copy.activation = activation;
+    copy.weights.reserve(weights.size());
+    for (const auto &w : weights)
+    {
+        copy.weights.push_back(make_parameter(w->get_data(), w->get_label()));
+    }
+    copy.bias = make_parameter(bias->get_data(), bias->get_label());
+    return copy;
+}
+
 const std::vector<std::shared_ptr<Value>>  FullyConnectedLayer::trainable_parameters() const
 {
     std::vector<std::shared_ptr<Value>> out;
@@ -103,13 +116,25 @@ const std::vector<std::shared_ptr<Value>>  FullyConnectedLayer::trainable_parame
 }
 
 // initialize a layer with num_inputs inputs and num_outputs outputs, creating num_outputs neurons that each take in num_inputs inputs
-FullyConnectedLayer::FullyConnectedLayer(int num_inputs, int num_outputs, int layer_index)
+FullyConnectedLayer::FullyConnectedLayer(int num_inputs, int num_outputs, int layer_index, Activation activation) : activation(activation)
 {
     neurons.reserve(num_outputs);
     for (int neuron_index = 0; neuron_index < num_outputs; neuron_index++)
     {
-        neurons.emplace_back(num_inputs, layer_index, neuron_index); // construct neuron in place
+        neurons.emplace_back(num_inputs, layer_index, neuron_index, activation); // construct neuron in place
+    }
+}
+
+FullyConnectedLayer FullyConnectedLayer::clone() const
+{
+    FullyConnectedLayer copy;
+    copy.activation = activation;
+    copy.neurons.reserve(neurons.size());
+    for (const auto &neuron : neurons)
+    {
+        copy.neurons.push_back(neuron.clone());
     }
+    return copy;
 }
 
 network_output_t FullyConnectedLayer::operator()(network_input_t x) const
@@ -135,6 +160,42 @@ network_output_t FullyConnectedLayer::operator()(network_input_t x) const
     return out;
 };
 
+std::shared_ptr<Tensor> FullyConnectedLayer::operator()(const std::shared_ptr<Tensor>& x) const
+{
+    size_t num_inputs = neurons.empty() ? 0 : neurons[0].get_weights().size();
+    if (x->cols() != num_inputs)
+    {
+        throw std::invalid_argument("Input size does not match weight size, input size: " + std::to_string(x->cols()) + ", weight size: " + std::to_string(num_inputs));
+    }
+
+    if (!parameter_data.empty())
+    {
+        // the layer's block of the ParameterStore already is one row per neuron, its weights then its bias: view it as a
+        // [num_outputs x (num_inputs + 1)] tensor, so the parameters are neither copied in nor their grads copied out
+        auto parameters = make_tensor_view(neurons.size(), num_inputs + 1, parameter_data, parameter_grads);
+        return activate(dense(x, parameters), activation);
+    }
+
+    // a layer outside a network: gather the neuron parameters into W [num_inputs x num_outputs] (column j holds neuron
+    // j's weights) and b [1 x num_outputs], whose grads are handed back to the Values by backward
+    network_output_t weight_values(num_inputs * neurons.size());
+    network_output_t bias_values;
+    bias_values.reserve(neurons.size());
+    for (size_t j = 0; j < neurons.size(); j++)
+    {
+        const auto &neuron_weights = neurons[j].get_weights();
+        for (size_t i = 0; i < num_inputs; i++)
+        {
+            weight_values[i * neurons.size() + j] = neuron_weights[i];
+        }
+        bias_values.push_back(neurons[j].get_bias());
+    }
+    auto W = pack(weight_values, num_inputs, neurons.size());
+    auto b = pack(bias_values, 1, neurons.size());
+
+    return activate(add_bias(matmul(x, W), b), activation);
+}
+
 const std::vector<std::shared_ptr<Value>>& FullyConnectedNetwork::trainable_parameters() const
 {
     // return reference to the cached parameers
@@ -142,27 +203,175 @@ const std::vector<std::shared_ptr<Value>>& FullyConnectedNetwork::trainable_para
 }
 
 // initialize a fully connected network with layer_sizes defining the number of neurons in each layer, and num_inputs defining the number of inputs to the network
-FullyConnectedNetwork::FullyConnectedNetwork(int num_inputs, const std::vector<int> &layer_sizes)
+FullyConnectedNetwork::FullyConnectedNetwork(int num_inputs, const std::vector<int> &layer_sizes, const std::vector<Activation> &activations)
 {
+    if (!activations.empty() && activations.size() != layer_sizes.size())
+    {
+        throw std::invalid_argument("Expected one activation per layer, got " + std::to_string(activations.size()) + " for " + std::to_string(layer_sizes.size()) + " layers");
+    }
     layers.reserve(layer_sizes.size());
     int current_input_size = num_inputs;
     for (size_t i = 0; i < layer_sizes.size(); i++)
     {
         int layer_size = layer_sizes[i];
-        layers.emplace_back(current_input_size, layer_size, i);
+        layers.emplace_back(current_input_size, layer_size, i, activations.empty() ? Activation::Tanh : activations[i]);
         current_input_size = layer_size;
     }
 
+    layer_widths[0] = num_inputs;
+    cache_parameters();
+}
+
+void FullyConnectedNetwork::cache_parameters()
+{
     // cache trainable parameters, TODO: if we implement/allow dynamic layers with changing sizes/nodes after instantiation, we need to update this cache
     for (const auto &layer : layers)
     {
         auto layer_params = layer.trainable_parameters();
         trainable_params_cache.insert(trainable_params_cache.end(), layer_params.begin(), layer_params.end());
+        layer_widths.push_back(layer.num_outputs());
+        layer_activations.push_back(layer.get_activation());
+    }
+    store = ParameterStore(trainable_params_cache);
+    size_t offset = 0;
+    for (auto &layer : layers)
+    {
+        size_t n = layer.num_outputs() * (layer.num_inputs() + 1);
+        layer.parameter_data = store.data().subspan(offset, n);
+        layer.parameter_grads = store.grad().subspan(offset, n);
+        offset += n;
+    }
+}
+
+FullyConnectedNetwork FullyConnectedNetwork::clone() const
+{
+    FullyConnectedNetwork copy;
+    copy.layers.reserve(layers.size());
+    for (const auto &layer : layers)
+    {
+        copy.layers.push_back(layer.clone());
     }
+    copy.layer_widths[0] = num_inputs();
+    copy.cache_parameters();
+    return copy;
+}
+
+float FullyConnectedNetwork::checkpointed_forward_backward(std::span<const network_input_t> batch, const sample_loss_fn_t &loss_fn, size_t layers_per_segment) const
+{
+    if (layers_per_segment == 0)
+    {
+        throw std::invalid_argument("Checkpointed segments need at least one layer");
+    }
+    if (batch.empty() || layers.empty())
+    {
+        return 0.0f;
+    }
+    size_t n_segments = (layers.size() + layers_per_segment - 1) / layers_per_segment;
+    size_t batch_size = batch.size();
+
+    // checkpoints[s] holds the inputs of segment s, [batch x width], segment 0 reads the batch itself
+    std::vector<std::vector<float>> checkpoints(n_segments);
+    auto segment_width = [&](size_t s) { return layer_widths[s * layers_per_segment]; };
+
+    // outputs of segment s for every sample, built from leaves holding its checkpoint (or from the batch for segment 0).
+    // leaves keeps the leaf Values alive, so their grads can be read after backward.
+    auto build_segment = [&](size_t s, std::vector<std::shared_ptr<Value>> &leaves) {
+        size_t width = segment_width(s);
+        leaves.clear();
+        if (s > 0)
+        {
+            for (float x : checkpoints[s])
+            {
+                leaves.push_back(make_value(x));
+            }
+        }
+        std::vector<network_output_t> outputs;
+        outputs.reserve(batch_size);
+        size_t end = std::min(layers.size(), (s + 1) * layers_per_segment);
+        for (size_t i = 0; i < batch_size; i++)
+        {
+            network_output_t out = s == 0 ? network_output_t(batch[i].begin(), batch[i].end())
+                                          : network_output_t(leaves.begin() + i * width, leaves.begin() + (i + 1) * width);
+            for (size_t l = s * layers_per_segment; l < end; l++)
+            {
+                out = layers[l](out);
+            }
+            outputs.push_back(std::move(out));
+        }
+        return outputs;
+    };
+
+    // our own arena and tape: each segment's graph is freed before the next one is built, and backward walks the tape
+    GraphArena arena;
+    Tape tape;
+    std::vector<std::shared_ptr<Value>> leaves;
+    for (size_t s = 0; s + 1 < n_segments; s++)
+    {
+        {
+            ArenaScope scope(arena);
+            RecordingScope recording(tape);
+            auto outputs = build_segment(s, leaves);
+            auto &next = checkpoints[s + 1];
+            next.clear();
+            for (const auto &out : outputs)
+            {
+                for (const auto &v : out)
+                {
+                    next.push_back(v->get_data());
+                }
+            }
+            leaves.clear();
+        }
+        arena.reset();
+    }
+
+    float total_loss = 0.0f;
+    std::vector<float> output_grads; // grads of the outputs of the segment being processed, [batch x width]
+    for (size_t s = n_segments; s-- > 0;)
+    {
+        {
+            ArenaScope scope(arena);
+            RecordingScope recording(tape);
+            // every output of the segment is held until its backward is done, including the ones loss_fn ignores
+            auto outputs = build_segment(s, leaves);
+            if (s + 1 == n_segments)
+            {
+                auto loss = loss_fn(outputs[0], 0);
+                for (size_t i = 1; i < batch_size; i++)
+                {
+                    loss = loss + loss_fn(outputs[i], i);
+                }
+                total_loss = loss->get_data();
+                loss->backward();
+            }
+            else
+            {
+                // seed the outputs with the grads the next segment left on its leaves, and carry on from there
+                size_t width = outputs[0].size();
+                for (size_t i = 0; i < batch_size; i++)
+                {
+                    for (size_t j = 0; j < width; j++)
+                    {
+                        outputs[i][j]->set_grad(output_grads[i * width + j]);
+                    }
+                }
+                tape.backward();
+            }
+            output_grads.clear();
+            for (const auto &leaf : leaves)
+            {
+                output_grads.push_back(leaf->get_grad());
+            }
+            leaves.clear();
+        }
+        arena.reset();
+    }
+    return total_loss;
 }
 
 network_output_t FullyConnectedNetwork::operator()(network_input_t x) const
 {
+    PROFILE_SCOPE("forward", "phase");
     network_output_t out(x.begin(), x.end());
 
 
@@ -180,6 +389,59 @@ network_output_t FullyConnectedNetwork::operator()(network_input_t x) const
 }
 
 
+void predict_fully_connected(std::span<const size_t> widths, std::span<const Activation> activations, const float* params,
+                             std::span<const float> x, std::span<float> out)
+{
+    if (x.size() != widths.front())
+    {
+        throw std::invalid_argument("Input size does not match network input size, input size: " + std::to_string(x.size()) + ", network input size: " + std::to_string(widths.front()));
+    }
+    if (out.size() != widths.back())
+    {
+        throw std::invalid_argument("Output size does not match network output size, output size: " + std::to_string(out.size()) + ", network output size: " + std::to_string(widths.back()));
+    }
+
+    // layer activations ping-pong between two scratch buffers that only ever grow
+    static thread_local std::vector<float> scratch[2];
+    const float* in = x.data();
+    size_t n_layers = activations.size();
+    for (size_t l = 0; l < n_layers; l++)
+    {
+        size_t n_in = widths[l];
+        size_t n_out = widths[l + 1];
+        float* dst = out.data();
+        if (l + 1 < n_layers)
+        {
+            auto& buffer = scratch[l % 2];
+            if (buffer.size() < n_out)
+            {
+                buffer.resize(n_out);
+            }
+            dst = buffer.data();
+        }
+        // same computation as LinearActivation::apply
+        for (size_t j = 0; j < n_out; j++)
+        {
+            dst[j] = activate(activations[l], simd::dot(params, in, n_in) + params[n_in]);
+            params += n_in + 1;
+        }
+        in = dst;
+    }
+}
+
+void FullyConnectedNetwork::predict(std::span<const float> x, std::span<float> out) const
+{
+    predict_fully_connected(layer_widths, layer_activations, store.data().data(), x, out);
+}
+
+std::vector<float> FullyConnectedNetwork::predict(std::span<const float> x) const
+{
+    std::vector<float> out(num_outputs());
+    predict(x, out);
+    return out;
+}
+
+
 std::vector<network_output_t> FullyConnectedNetwork::operator()(std::vector<network_input_t>& x) const
 {
     std::vector<network_output_t> outputs;
@@ -195,8 +457,46 @@ std::vector<network_output_t> FullyConnectedNetwork::operator()(std::vector<netw
 }
 
 
+std::shared_ptr<Tensor> FullyConnectedNetwork::operator()(const std::shared_ptr<Tensor>& x) const
+{
+    PROFILE_SCOPE("forward", "phase");
+    auto out = x;
+    for (const auto &layer : layers)
+    {
+        out = layer(out);
+    }
+    return out;
+}
+
+
+Optimizer::Optimizer(const std::vector<std::shared_ptr<Value>>& parameters, float learning_rate) : parameters(parameters), learning_rate(learning_rate)
+{
+    if (parameters.empty())
+    {
+        return;
+    }
+    float* first_data = parameters[0]->data_storage();
+    float* first_grad = parameters[0]->grad_storage();
+    for (size_t i = 1; i < parameters.size(); i++)
+    {
+        if (parameters[i]->data_storage() != first_data + i || parameters[i]->grad_storage() != first_grad + i)
+        {
+            return;
+        }
+    }
+    data = first_data;
+    grad = first_grad;
+}
+
 void Optimizer::step()
 {
+    ProfileScope profile("step", "phase", parameters.size());
+    if (data != nullptr)
+    {
+        // same update as below, in one vectorized pass: data -= learning_rate * grad
+        simd::axpy(-learning_rate, grad, data, parameters.size());
+        return;
+    }
     for (const auto& param : parameters)
     {
         float current_value = param->get_data();
@@ -213,9 +513,29 @@ void Optimizer::step()
     }
 }
 
+void Optimizer::atomic_step(const std::vector<std::shared_ptr<Value>>& gradients)
+{
+    ProfileScope profile("step", "phase", parameters.size());
+    if (gradients.size() != parameters.size())
+    {
+        throw std::invalid_argument("Optimizer::atomic_step: expected " + std::to_string(parameters.size()) + " gradients, got " + std::to_string(gradients.size()));
+    }
+    for (size_t i = 0; i < parameters.size(); i++)
+    {
+        // a fetch_add rather than load + store, so concurrent updates to the same parameter all land
+        parameters[i]->atomic_add_data(-learning_rate * gradients[i]->get_grad());
+    }
+}
+
 
 void Optimizer::zero_grad()
 {
+    ProfileScope profile("zero_grad", "phase", parameters.size());
+    if (grad != nullptr)
+    {
+        std::memset(grad, 0, parameters.size() * sizeof(float));
+        return;
+    }
     for (const auto& param : parameters)
     {
         param->set_grad(0.0f);
@@ -1,6 +1,10 @@
 // header for building blocks of neural network
+#include <functional>
+#pragma once
 #include "autograd.h"
 #include "operation.h"
+#include "tensor.h"
+#include "parameters.h"
 
 
 /**
@@ -8,6 +12,9 @@
  */
 using network_input_t = std::span<const std::shared_ptr<Value>>;
 using network_output_t = std::vector<std::shared_ptr<Value>>;
+// loss of one sample given the network outputs for it. DataParallel (parallel.h) calls it concurrently from several
+// threads, so it must not share mutable state.
+using sample_loss_fn_t = std::function<std::shared_ptr<Value>(const network_output_t &outputs, size_t sample_index)>;
 
 
 
@@ -16,12 +23,18 @@ class Neuron {
 public:
     
     // initialize a neuron that takes in num_inputs inputs. we also store the index of the layer and neuron for visualization purposes
-    Neuron(int num_inputs, int layer_index, int neuron_index);
+    Neuron(int num_inputs, int layer_index, int neuron_index, Activation activation = Activation::Tanh);
     std::shared_ptr<Value> operator()(network_input_t x) const;
     const std::vector<std::shared_ptr<Value>> trainable_parameters() const; // a list of all trainable parameters in the network
+    const network_output_t& get_weights() const { return weights; }
+    const std::shared_ptr<Value>& get_bias() const { return bias; }
+    // a neuron with the same weights and bias values, held in new parameter Values
+    Neuron clone() const;
 private:
+    Neuron() = default;
     network_output_t weights;
     std::shared_ptr<Value> bias;
+    Activation activation;
     std::vector<std::shared_ptr<Value>> get_trainable_parameters() const;
 
 };
@@ -29,13 +42,26 @@ private:
 class FullyConnectedLayer{
     public:
     // initialize a layer with num_inputs inputs and num_outputs outputs, creating num_outputs neurons that each take in num_inputs inputs
-    FullyConnectedLayer(int num_inputs, int num_outputs, int layer_index);
+    FullyConnectedLayer(int num_inputs, int num_outputs, int layer_index, Activation activation = Activation::Tanh);
     network_output_t operator()(network_input_t x) const ;
+    // tensor path: x is [batch x num_inputs], returns [batch x num_outputs] using one matrix multiply for the whole layer
+    std::shared_ptr<Tensor> operator()(const std::shared_ptr<Tensor>& x) const;
     const std::vector<std::shared_ptr<Value>> trainable_parameters() const; // a list of all trainable parameters in the layer
+    Activation get_activation() const { return activation; }
+    size_t num_inputs() const { return neurons.empty() ? 0 : neurons[0].get_weights().size(); }
+    size_t num_outputs() const { return neurons.size(); }
+    FullyConnectedLayer clone() const; // see Neuron::clone
 
     private:
+    friend class FullyConnectedNetwork; // binds parameter_data/parameter_grads
+    FullyConnectedLayer() = default;
     // no shared_ptr since the neurons are owned by the layer
     std::vector<Neuron> neurons;
+    Activation activation;
+    // this layer's slice of its network's ParameterStore (per neuron its weights, then its bias), empty for a layer on
+    // its own. The tensor path reads its weights from here in place.
+    std::span<float> parameter_data;
+    std::span<float> parameter_grads;
 
 };
 
@@ -43,28 +69,87 @@ class FullyConnectedLayer{
 class FullyConnectedNetwork {
 public:
     // initialize a fully connected network with layer_sizes defining the number of neurons in each layer, and num_inputs defining the number of inputs to the network
-    FullyConnectedNetwork(int num_inputs, const std::vector<int>& layer_sizes);
+    // activations picks the activation of each layer (same length as layer_sizes), or tanh everywhere if empty
+    FullyConnectedNetwork(int num_inputs, const std::vector<int>& layer_sizes, const std::vector<Activation>& activations = {});
     network_output_t operator()(network_input_t x) const;
     std::vector<network_output_t> operator()(std::vector<network_input_t>& x) const;
+    // tensor path over a whole batch, x is [batch x num_inputs], returns [batch x num_outputs]
+    std::shared_ptr<Tensor> operator()(const std::shared_ptr<Tensor>& x) const;
+    /**
+     * Inference only: evaluates the network on raw floats straight from the parameter store, without building a graph.
+     * Gives the same outputs as operator() (same kernels, in the same order). The span version allocates nothing once
+     * the per-thread scratch buffers have grown to the widest layer; out must hold one float per output.
+     */
+    void predict(std::span<const float> x, std::span<float> out) const;
+    std::vector<float> predict(std::span<const float> x) const;
+    size_t num_inputs() const { return layer_widths.front(); }
+    size_t num_outputs() const { return layer_widths.back(); }
+    // the number of inputs, followed by the size of every layer
+    const std::vector<size_t>& get_layer_widths() const { return layer_widths; }
+    const std::vector<Activation>& get_activations() const { return layer_activations; }
     const std::vector<std::shared_ptr<Value>>& trainable_parameters() const; // a list of all trainable parameters in the network
+    // contiguous data/grad buffers behind trainable_parameters(), in the same order (per neuron: its weights, then its bias)
+    ParameterStore& parameter_store() { return store; }
+    const ParameterStore& parameter_store() const { return store; }
+    // a network with the same shape and parameter values, but its own parameter Values (e.g. one replica per thread)
+    FullyConnectedNetwork clone() const;
+    /**
+     * Gradient checkpointing: same result as building the graph of the whole batch, summing loss_fn over the samples and
+     * calling backward (grads are accumulated into the parameters and the inputs, and the summed loss is returned), but
+     * only the graph of one segment of layers_per_segment layers is alive at a time.
+     *
+     * The forward pass keeps just the activations at segment boundaries, as floats. The backward pass then rebuilds the
+     * segments from the last to the first, each from its boundary activations, and backprops the grads of its outputs
+     * (from the segment after it) through it. That is roughly one extra forward pass of compute, for a peak graph size
+     * of one segment instead of the whole network. Each segment's graph lives in a GraphArena and is recorded on a Tape
+     * of this call, whatever scopes the caller has open. Grads may differ from the plain path in the last bits, since
+     * they are summed in a different order.
+     */
+    float checkpointed_forward_backward(std::span<const network_input_t> batch, const sample_loss_fn_t& loss_fn, size_t layers_per_segment = 1) const;
 
 private:
+    FullyConnectedNetwork() = default;
+    void cache_parameters(); // fills trainable_params_cache, store and the shape below from layers
     std::vector<FullyConnectedLayer> layers;
     std::vector<std::shared_ptr<Value>> trainable_params_cache;
+    ParameterStore store; // backs every Value in trainable_params_cache
+    std::vector<size_t> layer_widths{0};
+    std::vector<Activation> layer_activations;
 };
 
+/**
+ * Graph-free forward pass of a fully connected network whose parameters are one float buffer, laid out like
+ * FullyConnectedNetwork::parameter_store(): layer after layer, per neuron its weights then its bias. widths is the
+ * number of inputs followed by the size of every layer. Shared by FullyConnectedNetwork::predict and MappedNetwork
+ * (checkpoint.h); see predict for the allocation behaviour.
+ */
+void predict_fully_connected(std::span<const size_t> widths, std::span<const Activation> activations, const float* params,
+                             std::span<const float> x, std::span<float> out);
+
 
 
 class Optimizer {
 public:
-    Optimizer(const std::vector<std::shared_ptr<Value>>& parameters, float learning_rate) : parameters(parameters), learning_rate(learning_rate) {}
-    
+    // if the parameters live in one ParameterStore, in order (e.g. FullyConnectedNetwork::trainable_parameters()), step
+    // and zero_grad work directly on its buffers instead of one Value at a time
+    Optimizer(const std::vector<std::shared_ptr<Value>>& parameters, float learning_rate);
+
     // updates the parameters using their gradients and the learning rate
     void step();
 
+    /**
+     * Same update as step(), but the grads are read from `gradients` (parameters of the same shape, e.g. those of a
+     * replica of the network) and applied with relaxed atomic adds. Several threads can call this concurrently on the
+     * same parameters without any lock; updates are never lost, but a thread may compute its grads on slightly stale
+     * values (Hogwild-style SGD).
+     */
+    void atomic_step(const std::vector<std::shared_ptr<Value>>& gradients);
+
     // zeros out all gradients in the parameters, to be used before a new backward pass
     void zero_grad();
 private:
     const std::vector<std::shared_ptr<Value>>& parameters;
     float learning_rate;
+    float* data = nullptr; // start of the contiguous data of the parameters, nullptr if they are not contiguous
+    float* grad = nullptr; // same for the grads
 };
\ No newline at end of file
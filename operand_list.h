@@ -0,0 +1,93 @@
+/**
+ * Operand storage of a graph node, sized so that the common case needs no allocation of its own.
+ */
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#pragma once
+
+class Value;
+
+/**
+ * The operands of a Value. Up to INLINE_CAPACITY of them are stored in the list itself, which covers every scalar op,
+ * so building those nodes takes a single allocation (node and control block). Longer lists (e.g. Linear's 2N+1
+ * operands) go in one array from the node's memory resource, with the resource stored in front of the array so the
+ * list stays at 40 bytes either way.
+ *
+ * The operands are fixed once the list is built; clear() is the only way to change them (see Value::release_operands).
+ * Iterators are plain pointers, so the list converts to std::span<const std::shared_ptr<Value>>.
+ */
+class OperandList
+{
+public:
+    static constexpr size_t INLINE_CAPACITY = 2;
+
+    OperandList() noexcept : heap(nullptr), count(0) {}
+    OperandList(std::span<const std::shared_ptr<Value>> operands, std::pmr::memory_resource *resource)
+        : heap(nullptr), count(static_cast<uint32_t>(operands.size()))
+    {
+        std::shared_ptr<Value> *slots = inline_operands;
+        if (spilled())
+        {
+            heap = static_cast<Spill *>(resource->allocate(spill_bytes(count), alignof(Spill)));
+            heap->resource = resource;
+            slots = heap->operands();
+        }
+        std::uninitialized_copy(operands.begin(), operands.end(), slots);
+    }
+    ~OperandList()
+    {
+        clear();
+    }
+    OperandList(const OperandList &) = delete;
+    OperandList &operator=(const OperandList &) = delete;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    std::shared_ptr<Value> *data() { return spilled() ? heap->operands() : inline_operands; }
+    const std::shared_ptr<Value> *data() const { return spilled() ? heap->operands() : inline_operands; }
+    std::shared_ptr<Value> *begin() { return data(); }
+    std::shared_ptr<Value> *end() { return data() + count; }
+    const std::shared_ptr<Value> *begin() const { return data(); }
+    const std::shared_ptr<Value> *end() const { return data() + count; }
+    const std::shared_ptr<Value> &operator[](size_t i) const { return data()[i]; }
+
+    // bytes of the out-of-line array (0 while the operands are inline)
+    size_t heap_bytes() const { return spilled() ? spill_bytes(count) : 0; }
+
+    // drops every operand and gives the array back to its resource
+    void clear() noexcept
+    {
+        std::shared_ptr<Value> *slots = data();
+        for (size_t i = 0; i < count; i++)
+        {
+            slots[i].~shared_ptr();
+        }
+        if (spilled())
+        {
+            heap->resource->deallocate(heap, spill_bytes(count), alignof(Spill));
+        }
+        heap = nullptr;
+        count = 0;
+    }
+
+private:
+    struct Spill
+    {
+        std::pmr::memory_resource *resource;
+        std::shared_ptr<Value> *operands() { return reinterpret_cast<std::shared_ptr<Value> *>(this + 1); }
+    };
+    static_assert(sizeof(Spill) % alignof(std::shared_ptr<Value>) == 0);
+
+    static size_t spill_bytes(size_t n) { return sizeof(Spill) + n * sizeof(std::shared_ptr<Value>); }
+    bool spilled() const { return count > INLINE_CAPACITY; }
+
+    union
+    {
+        std::shared_ptr<Value> inline_operands[INLINE_CAPACITY]; // live while count <= INLINE_CAPACITY
+        Spill *heap;                                             // live otherwise
+    };
+    uint32_t count;
+};
@@ -4,22 +4,38 @@
 #include <iostream>
 #include "operation.h"
 #include "autograd.h"
+#include "simd.h"
+#include "profiler.h"
 
 
+float Operation::apply(std::span<const float>) const {
+    throw std::logic_error("Operation " + get_name() + " has no apply kernel");
+}
+
+void Operation::local_grads(std::span<const float>, float, std::span<float>) const {
+    throw std::logic_error("Operation " + get_name() + " has no local_grads kernel");
+}
+
 // Implementations of Operation subclasses
 
 std::shared_ptr<Value> Add::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Add::forward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Add operation requires exactly two inputs");
     }
     float result = inputs[0]->get_data() + inputs[1]->get_data();
-    return std::make_shared<Value>(result, std::vector<std::shared_ptr<Value>>(inputs.begin(), inputs.end()), shared_from_this());
+    return make_node(result, inputs, shared_from_this());
 }
-void Add::backward(std::span<const std::shared_ptr<Value>> inputs, std::shared_ptr<const Value> out) const {
+void Add::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Add::backward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Add operation requires exactly two inputs");
     }
-    auto out_grad = out->get_grad();
+    backward_unchecked(inputs, out);
+}
+
+void Add::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
+    auto out_grad = out.get_grad();
     // we add it since gradient contributions for subfunctions of x add up (linearity of differentiation)
     // Intuition: https://math.stackexchange.com/q/1327030
     inputs[0]->add_grad(out_grad);
@@ -29,20 +45,35 @@ std::string Add::get_name() const {
     return "+";
 }
 
+float Add::apply(std::span<const float> inputs) const {
+    return inputs[0] + inputs[1];
+}
+
+void Add::local_grads(std::span<const float>, float, std::span<float> grads) const {
+    grads[0] = 1.0f;
+    grads[1] = 1.0f;
+}
+
 
 std::shared_ptr<Value> Subtract::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Subtract::forward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Subtract operation requires exactly two inputs");
     }
     float result = inputs[0]->get_data() - inputs[1]->get_data();
-    return std::make_shared<Value>(result, std::vector<std::shared_ptr<Value>>(inputs.begin(), inputs.end()), shared_from_this());
+    return make_node(result, inputs, shared_from_this());
 }
 
-void Subtract::backward(std::span<const std::shared_ptr<Value>> inputs, std::shared_ptr<const Value> out) const {
+void Subtract::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Subtract::backward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Subtract operation requires exactly two inputs");
     }
-    auto out_grad = out->get_grad();
+    backward_unchecked(inputs, out);
+}
+
+void Subtract::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
+    auto out_grad = out.get_grad();
     inputs[0]->add_grad(out_grad);
     inputs[1]->add_grad(-1 * out_grad); // since its inputs[0] - inputs[1]
 }
@@ -51,32 +82,57 @@ std::string Subtract::get_name() const {
     return "-";
 }
 
+float Subtract::apply(std::span<const float> inputs) const {
+    return inputs[0] - inputs[1];
+}
+
+void Subtract::local_grads(std::span<const float>, float, std::span<float> grads) const {
+    grads[0] = 1.0f;
+    grads[1] = -1.0f;
+}
+
 
 
 
 std::shared_ptr<Value> Multiply::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Multiply::forward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Multiply operation requires exactly two inputs");
     }
     float result = inputs[0]->get_data() * inputs[1]->get_data();
-    return std::make_shared<Value>(result, std::vector<std::shared_ptr<Value>>(inputs.begin(), inputs.end()), shared_from_this());
+    return make_node(result, inputs, shared_from_this());
 }
 
-void Multiply::backward(std::span<const std::shared_ptr<Value>> inputs, std::shared_ptr<const Value> out) const {
+void Multiply::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Multiply::backward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Multiply operation requires exactly two inputs");
     }
+    backward_unchecked(inputs, out);
+}
+
+void Multiply::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
     // using the product rule
-    inputs[0]->add_grad(inputs[1]->get_data() * out->get_grad());
-    inputs[1]->add_grad(inputs[0]->get_data() * out->get_grad());
+    inputs[0]->add_grad(inputs[1]->get_data() * out.get_grad());
+    inputs[1]->add_grad(inputs[0]->get_data() * out.get_grad());
 }
 
 std::string Multiply::get_name() const {
     return "*";
 }
 
+float Multiply::apply(std::span<const float> inputs) const {
+    return inputs[0] * inputs[1];
+}
+
+void Multiply::local_grads(std::span<const float> inputs, float, std::span<float> grads) const {
+    grads[0] = inputs[1];
+    grads[1] = inputs[0];
+}
+
 
 std::shared_ptr<Value> Divide::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Divide::forward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Divide operation requires exactly two inputs");
     }
@@ -84,20 +140,25 @@ std::shared_ptr<Value> Divide::forward(std::span<const std::shared_ptr<Value>> i
         throw std::runtime_error("Division by zero");
     }
     float result = inputs[0]->get_data() / inputs[1]->get_data();
-    return std::make_shared<Value>(result, std::vector<std::shared_ptr<Value>>(inputs.begin(), inputs.end()), shared_from_this());
+    return make_node(result, inputs, shared_from_this());
 }
 
-void Divide::backward(std::span<const std::shared_ptr<Value>> inputs, std::shared_ptr<const Value> out) const {
+void Divide::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Divide::backward", "op", inputs.size());
     if (inputs.size() != 2) {
         throw std::runtime_error("Divide operation requires exactly two inputs");
     }
-    auto out_grad = out->get_grad();
+    backward_unchecked(inputs, out);
+}
+
+void Divide::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
+    auto out_grad = out.get_grad();
     // y = a/b = a * (1/b)
 
     // dy/da = 1/b
     inputs[0]->add_grad((1.0f / inputs[1]->get_data()) * out_grad); 
     // dy/db = -a/(b^2) = (a/b) * (1/b)
-    inputs[1]->add_grad( (out->get_data()) * (-1.0f / inputs[1]->get_data()) * out_grad);
+    inputs[1]->add_grad( (out.get_data()) * (-1.0f / inputs[1]->get_data()) * out_grad);
 }
 
 
@@ -105,23 +166,41 @@ std::string Divide::get_name() const {
     return "/";
 }
 
+float Divide::apply(std::span<const float> inputs) const {
+    if (inputs[1] == 0) {
+        throw std::runtime_error("Division by zero");
+    }
+    return inputs[0] / inputs[1];
+}
+
+void Divide::local_grads(std::span<const float> inputs, float out, std::span<float> grads) const {
+    grads[0] = 1.0f / inputs[1];
+    grads[1] = out * (-1.0f / inputs[1]);
+}
+
 
 
 std::shared_ptr<Value> Exp::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Exp::forward", "op", inputs.size());
     if (inputs.size() != 1) {
         throw std::runtime_error("Exp operation requires exactly one input");
     }
     float result = std::exp(inputs[0]->get_data());
-    return std::make_shared<Value>(result, std::vector<std::shared_ptr<Value>>(inputs.begin(), inputs.end()), shared_from_this());
+    return make_node(result, inputs, shared_from_this());
 }
 
-void Exp::backward(std::span<const std::shared_ptr<Value>> inputs, std::shared_ptr<const Value> out) const {
+void Exp::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Exp::backward", "op", inputs.size());
     if (inputs.size() != 1) {
         throw std::runtime_error("Exp operation requires exactly one input");
     }
-    auto out_grad = out->get_grad();
+    backward_unchecked(inputs, out);
+}
+
+void Exp::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
+    auto out_grad = out.get_grad();
     // d(exp(x))/dx = exp(x)
-    float exp_x =  out->get_data(); // since out = exp(x)
+    float exp_x =  out.get_data(); // since out = exp(x)
     inputs[0]->add_grad(exp_x * out_grad);
 }
 
@@ -129,28 +208,43 @@ std::string Exp::get_name() const {
     return "exp";
 }
 
+float Exp::apply(std::span<const float> inputs) const {
+    return std::exp(inputs[0]);
+}
+
+void Exp::local_grads(std::span<const float>, float out, std::span<float> grads) const {
+    grads[0] = out; // since out = exp(x)
+}
+
 
 
 float tanh_manual(float x) {
-    return (std::exp(2.0f * x) - 1.0f) / (std::exp(2.0f * x) + 1.0f);
+    // (e^2x - 1) / (e^2x + 1) overflows to inf/inf = NaN for large x, so use the stable form instead
+    return simd::tanh_stable(x);
 }
 
 std::shared_ptr<Value> Tanh::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Tanh::forward", "op", inputs.size());
     if (inputs.size() != 1) {
         throw std::runtime_error("Tanh operation requires exactly one input");
     }
     float result = tanh_manual(inputs[0]->get_data());
-    return std::make_shared<Value>(result, std::vector<std::shared_ptr<Value>>(inputs.begin(), inputs.end()), shared_from_this());
+    return make_node(result, inputs, shared_from_this());
 }
 
 
-void Tanh::backward(std::span<const std::shared_ptr<Value>> inputs, std::shared_ptr<const Value> out) const {
+void Tanh::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Tanh::backward", "op", inputs.size());
     if (inputs.size() != 1) {
         throw std::runtime_error("Tanh operation requires exactly one input");
     }
+    backward_unchecked(inputs, out);
+}
+
+void Tanh::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
     // d(tanh(x))/dx = 1 - tanh^2(x)
-    auto out_grad = out->get_grad();
-    float t = out->get_data(); // tanh(x)
+    auto out_grad = out.get_grad();
+    float t = out.get_data(); // tanh(x)
     inputs[0]->add_grad((1.0f - t * t) * out_grad);
 }
 
@@ -158,6 +252,156 @@ std::string Tanh::get_name() const {
     return "tanh";
 }
 
+float Tanh::apply(std::span<const float> inputs) const {
+    return tanh_manual(inputs[0]);
+}
+
+void Tanh::local_grads(std::span<const float>, float out, std::span<float> grads) const {
+    grads[0] = 1.0f - out * out;
+}
+
+
+/**
+ * Linear's operands are [w_0..w_{N-1}, x_0..x_{N-1}, bias]. The operand data is gathered into one contiguous buffer, so
+ * the dot product (and each half of the backward pass) is a single vectorized loop.
+ */
+static thread_local std::vector<float> linear_scratch;
+static thread_local std::vector<float> linear_grad_scratch;
+
+static void gather_data(std::span<const std::shared_ptr<Value>> inputs, std::vector<float> &out) {
+    out.resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        out[i] = inputs[i]->get_data();
+    }
+}
+
+std::shared_ptr<Value> Linear::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("Linear::forward", "op", inputs.size());
+    if (inputs.size() % 2 != 1) {
+        throw std::runtime_error("Linear operation requires 2N+1 inputs (N weights, N inputs, bias), got " + std::to_string(inputs.size()));
+    }
+    gather_data(inputs, linear_scratch);
+    float result = apply(linear_scratch);
+    return make_node(result, inputs, shared_from_this());
+}
+
+void Linear::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("Linear::backward", "op", inputs.size());
+    if (inputs.size() % 2 != 1) {
+        throw std::runtime_error("Linear operation requires 2N+1 inputs (N weights, N inputs, bias), got " + std::to_string(inputs.size()));
+    }
+    backward_unchecked(inputs, out);
+}
+
+void Linear::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) {
+    size_t n = inputs.size() / 2;
+    auto out_grad = out.get_grad();
+    gather_data(inputs, linear_scratch);
+    linear_grad_scratch.resize(inputs.size());
+
+    // d(out)/d(w_i) = x_i and d(out)/d(x_i) = w_i
+    simd::scale(out_grad, linear_scratch.data() + n, linear_grad_scratch.data(), n);
+    simd::scale(out_grad, linear_scratch.data(), linear_grad_scratch.data() + n, n);
+    linear_grad_scratch[2 * n] = out_grad;
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i]->add_grad(linear_grad_scratch[i]);
+    }
+}
+
+std::string Linear::get_name() const {
+    return "linear";
+}
+
+float Linear::apply(std::span<const float> inputs) const {
+    size_t n = inputs.size() / 2;
+    return simd::dot(inputs.data(), inputs.data() + n, n) + inputs[2 * n];
+}
+
+void Linear::local_grads(std::span<const float> inputs, float, std::span<float> grads) const {
+    size_t n = inputs.size() / 2;
+    std::copy(inputs.begin() + n, inputs.begin() + 2 * n, grads.begin());
+    std::copy(inputs.begin(), inputs.begin() + n, grads.begin() + n);
+    grads[2 * n] = 1.0f;
+}
+
+
+std::shared_ptr<Value> LinearActivation::forward(std::span<const std::shared_ptr<Value>> inputs) const {
+    ProfileScope profile("LinearActivation::forward", "op", inputs.size());
+    if (inputs.size() % 2 != 1) {
+        throw std::runtime_error("LinearActivation operation requires 2N+1 inputs (N weights, N inputs, bias), got " + std::to_string(inputs.size()));
+    }
+    gather_data(inputs, linear_scratch);
+    float result = apply(linear_scratch);
+    return make_node(result, inputs, shared_from_this());
+}
+
+void LinearActivation::backward(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    ProfileScope profile("LinearActivation::backward", "op", inputs.size());
+    if (inputs.size() % 2 != 1) {
+        throw std::runtime_error("LinearActivation operation requires 2N+1 inputs (N weights, N inputs, bias), got " + std::to_string(inputs.size()));
+    }
+    backward_unchecked(inputs, out);
+}
+
+void LinearActivation::backward_unchecked(std::span<const std::shared_ptr<Value>> inputs, const Value& out) const {
+    size_t n = inputs.size() / 2;
+    // grad w.r.t the (never materialized) pre-activation
+    float pre_grad = activation_derivative(activation, out.get_data()) * out.get_grad();
+    gather_data(inputs, linear_scratch);
+    linear_grad_scratch.resize(inputs.size());
+
+    simd::scale(pre_grad, linear_scratch.data() + n, linear_grad_scratch.data(), n);
+    simd::scale(pre_grad, linear_scratch.data(), linear_grad_scratch.data() + n, n);
+    linear_grad_scratch[2 * n] = pre_grad;
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i]->add_grad(linear_grad_scratch[i]);
+    }
+}
+
+std::string LinearActivation::get_name() const {
+    return "linear+" + activation_name(activation);
+}
+
+float LinearActivation::apply(std::span<const float> inputs) const {
+    size_t n = inputs.size() / 2;
+    return activate(activation, simd::dot(inputs.data(), inputs.data() + n, n) + inputs[2 * n]);
+}
+
+void LinearActivation::local_grads(std::span<const float> inputs, float out, std::span<float> grads) const {
+    size_t n = inputs.size() / 2;
+    float d = activation_derivative(activation, out);
+    simd::scale(d, inputs.data() + n, grads.data(), n);
+    simd::scale(d, inputs.data(), grads.data() + n, n);
+    grads[2 * n] = d;
+}
+
+
+void backward_node(const Value& node) {
+    std::span<const std::shared_ptr<Value>> inputs(node.get_prev().data(), node.get_prev().size());
+    if (PROFILING && profiler::enabled()) [[unlikely]] {
+        // the virtual backwards record each call, the kernels below don't
+        node.get_operation()->backward(inputs, node);
+        return;
+    }
+    // the kernels are defined above in this file, so each case compiles down to the kernel itself
+    switch (node.get_op_kind()) {
+        case OpKind::Add: Add::backward_unchecked(inputs, node); return;
+        case OpKind::Subtract: Subtract::backward_unchecked(inputs, node); return;
+        case OpKind::Multiply: Multiply::backward_unchecked(inputs, node); return;
+        case OpKind::Divide: Divide::backward_unchecked(inputs, node); return;
+        case OpKind::Exp: Exp::backward_unchecked(inputs, node); return;
+        case OpKind::Tanh: Tanh::backward_unchecked(inputs, node); return;
+        case OpKind::Linear: Linear::backward_unchecked(inputs, node); return;
+        case OpKind::LinearActivation:
+            static_cast<const LinearActivation &>(*node.get_operation()).backward_unchecked(inputs, node);
+            return;
+        case OpKind::Custom: break;
+    }
+    node.get_operation()->backward(inputs, node);
+}
+
 
 namespace operation {
 
@@ -200,35 +444,35 @@ std::shared_ptr<Value> tanh(const std::shared_ptr<Value> &x)
 // addition operations for floats directly
 std::shared_ptr<Value> operator+(float a, const std::shared_ptr<Value> &b)
 {
-    return make_value(a) + b;
+    return make_constant(a) + b;
 }
 std::shared_ptr<Value> operator+(const std::shared_ptr<Value> &a, float b)
 {
-    return a + make_value(b);
+    return a + make_constant(b);
 }
 std::shared_ptr<Value> operator-(float a, const std::shared_ptr<Value> &b)
 {
-    return make_value(a) - b;
+    return make_constant(a) - b;
 }
 std::shared_ptr<Value> operator-(const std::shared_ptr<Value> &a, float b)
 {
-    return a - make_value(b);
+    return a - make_constant(b);
 }
 std::shared_ptr<Value> operator*(float a, const std::shared_ptr<Value> &b)
 {
-    return make_value(a) * b;
+    return make_constant(a) * b;
 }
 std::shared_ptr<Value> operator*(const std::shared_ptr<Value> &a, float b)
 {
-    return a * make_value(b);
+    return a * make_constant(b);
 }
 std::shared_ptr<Value> operator/(float a, const std::shared_ptr<Value> &b)
 {
-    return make_value(a) / b;
+    return make_constant(a) / b;
 }
 std::shared_ptr<Value> operator/(const std::shared_ptr<Value> &a, float b)
 {
-    return a / make_value(b);
+    return a / make_constant(b);
 }
 
 std::shared_ptr<Value> exp(const std::shared_ptr<Value> &x){
@@ -237,8 +481,46 @@ std::shared_ptr<Value> exp(const std::shared_ptr<Value> &x){
     return exp_op->forward(inputs);
 }
 
+std::shared_ptr<Value> linear(std::span<const std::shared_ptr<Value>> weights, std::span<const std::shared_ptr<Value>> x, const std::shared_ptr<Value> &bias)
+{
+    static auto linear_op = std::make_shared<Linear>();
+    if (weights.size() != x.size()) {
+        throw std::invalid_argument("Input size does not match weight size, input size: " + std::to_string(x.size()) + ", weight size: " + std::to_string(weights.size()));
+    }
+    // reused across calls so building the operand list doesn't allocate
+    static thread_local std::vector<std::shared_ptr<Value>> operands;
+    operands.clear();
+    operands.insert(operands.end(), weights.begin(), weights.end());
+    operands.insert(operands.end(), x.begin(), x.end());
+    operands.push_back(bias);
+    auto out = linear_op->forward(operands);
+    operands.clear();
+    return out;
+}
+
+std::shared_ptr<Value> linear(std::span<const std::shared_ptr<Value>> weights, std::span<const std::shared_ptr<Value>> x, const std::shared_ptr<Value> &bias, Activation activation)
+{
+    // one shared op per activation, indexed by the enum value
+    static const std::array<std::shared_ptr<LinearActivation>, 3> linear_activation_ops{
+        std::make_shared<LinearActivation>(Activation::Tanh),
+        std::make_shared<LinearActivation>(Activation::Sigmoid),
+        std::make_shared<LinearActivation>(Activation::ReLU),
+    };
+    if (weights.size() != x.size()) {
+        throw std::invalid_argument("Input size does not match weight size, input size: " + std::to_string(x.size()) + ", weight size: " + std::to_string(weights.size()));
+    }
+    static thread_local std::vector<std::shared_ptr<Value>> operands;
+    operands.clear();
+    operands.insert(operands.end(), weights.begin(), weights.end());
+    operands.insert(operands.end(), x.begin(), x.end());
+    operands.push_back(bias);
+    auto out = linear_activation_ops[static_cast<size_t>(activation)]->forward(operands);
+    operands.clear();
+    return out;
+}
+
 std::shared_ptr<Value> exp(float x){
-    return exp(make_value(x));
+    return exp(make_constant(x));
 }
 
 }
\ No newline at end of file
@@ -1,7 +1,15 @@
+#include <cstdint>
 #include <span>
 #pragma once
+#include "activation.h"
 class Value;
 
+/**
+ * The operations defined below, so the backward loops can dispatch through a switch (see backward_node) instead of a
+ * virtual call per node. Operations defined elsewhere are Custom and go through their virtual backward.
+ */
+enum class OpKind : uint8_t { Custom, Add, Subtract, Multiply, Divide, Exp, Tanh, Linear, LinearActivation };
+
 class Operation : public std::enable_shared_from_this<Operation>{
     /**
      * Defines the name of an operation, what it does to inputs, and how to propagate gradients through it.
@@ -17,21 +25,46 @@ class Operation : public std::enable_shared_from_this<Operation>{
         virtual std::shared_ptr<Value> forward(std::span<std::shared_ptr<Value> const> inputs) const = 0;
 
         // backward accumulates grads into inputs from the direct output of those inputs. This is the gradient of some final output w.r.t the output of this operation, not necessarily the immediate output
+        // out is taken by reference so the backward loops don't pay for a shared_ptr copy per node
         // TODO: refactor to validate that out.operation == this
-        virtual void backward(std::span<const std::shared_ptr<Value> > inputs, std::shared_ptr<const Value> out) const = 0;
+        virtual void backward(std::span<const std::shared_ptr<Value> > inputs, const Value& out) const = 0;
 
         virtual std::string get_name() const = 0;
 
+        // raw float kernels, so an operation can be replayed on preassigned buffers without building nodes (see compiled.h)
+        // apply computes the output from the input data, local_grads writes d(out)/d(inputs[i]) into grads[i].
+        // Optional: an operation without them still works everywhere nodes are built, and has_kernels() is false for it,
+        // so CompiledGraph refuses it and the graph optimizer doesn't fold it. The defaults throw std::logic_error.
+        virtual float apply(std::span<const float> inputs) const;
+        virtual void local_grads(std::span<const float> inputs, float out, std::span<float> grads) const;
+        virtual bool has_kernels() const { return false; } // whether apply and local_grads are overridden
+
+        OpKind kind() const { return op_kind; }
+
+    protected:
+        explicit Operation(OpKind kind = OpKind::Custom) : op_kind(kind) {}
+
+    private:
+        OpKind op_kind;
 };
 
 #define DECLARE_OPERATION_CLASS(OP_NAME) \
  class OP_NAME : public Operation { \
      public: \
+         OP_NAME() : Operation(OpKind::OP_NAME) {} \
+  \
          std::shared_ptr<Value> forward(std::span<std::shared_ptr<Value> const> inputs) const override; \
   \
-         void backward(std::span<std::shared_ptr<Value> const> inputs, std::shared_ptr<const Value> out) const override; \
+         void backward(std::span<std::shared_ptr<Value> const> inputs, const Value& out) const override; \
+         /* backward without the operand count check, for backward_node */ \
+         static void backward_unchecked(std::span<std::shared_ptr<Value> const> inputs, const Value& out); \
   \
          std::string get_name() const override; \
+  \
+         float apply(std::span<const float> inputs) const override; \
+  \
+         void local_grads(std::span<const float> inputs, float out, std::span<float> grads) const override; \
+         bool has_kernels() const override { return true; } \
  };
 DECLARE_OPERATION_CLASS(Add)
 DECLARE_OPERATION_CLASS(Subtract)
@@ -39,6 +72,43 @@ DECLARE_OPERATION_CLASS(Multiply)
 DECLARE_OPERATION_CLASS(Divide)
 DECLARE_OPERATION_CLASS(Exp)
 DECLARE_OPERATION_CLASS(Tanh)
+DECLARE_OPERATION_CLASS(Linear) // fused dot product + bias over 2N+1 operands: [w_0..w_{N-1}, x_0..x_{N-1}, bias]
+
+/**
+ * Linear followed by an activation, as a single node: out = f(sum_i w_i * x_i + bias), with the same operands as Linear.
+ *
+ * The pre-activation never becomes a node. Backward only needs f'(pre-activation), which every supported activation can
+ * express in terms of the stored output (see activation_derivative), so backward does no transcendental math.
+ */
+class LinearActivation : public Operation {
+    public:
+        explicit LinearActivation(Activation activation) : Operation(OpKind::LinearActivation), activation(activation) {}
+
+        std::shared_ptr<Value> forward(std::span<std::shared_ptr<Value> const> inputs) const override;
+
+        void backward(std::span<std::shared_ptr<Value> const> inputs, const Value& out) const override;
+        void backward_unchecked(std::span<std::shared_ptr<Value> const> inputs, const Value& out) const; // see backward_node
+
+        std::string get_name() const override;
+
+        float apply(std::span<const float> inputs) const override;
+
+        void local_grads(std::span<const float> inputs, float out, std::span<float> grads) const override;
+        bool has_kernels() const override { return true; }
+
+        Activation get_activation() const { return activation; }
+    private:
+        Activation activation;
+};
+
+/**
+ * Backward through one node (which must have an operation), same result as
+ * node.get_operation()->backward(node.get_prev(), node). The built-in operations are dispatched on the kind cached in
+ * the node, with their kernels inlined and without re-checking the operand count, which forward already checked when
+ * it built the node. Nodes released by Value::backward(false) are leaves, so they never get here. While the profiler
+ * is enabled, every node goes through the virtual backward instead, which records the call.
+ */
+void backward_node(const Value& node);
 
 namespace operation {
 /**
@@ -53,6 +123,11 @@ std::shared_ptr<Value> operator/(const std::shared_ptr<Value> &a, const std::sha
 std::shared_ptr<Value> tanh(const std::shared_ptr<Value> &x);
 std::shared_ptr<Value> exp(const std::shared_ptr<Value> &x); // e^x
 
+// sum_i weights[i] * x[i] + bias as a single node, instead of 2N chained multiply/add nodes
+std::shared_ptr<Value> linear(std::span<const std::shared_ptr<Value>> weights, std::span<const std::shared_ptr<Value>> x, const std::shared_ptr<Value> &bias);
+// f(sum_i weights[i] * x[i] + bias) as a single node
+std::shared_ptr<Value> linear(std::span<const std::shared_ptr<Value>> weights, std::span<const std::shared_ptr<Value>> x, const std::shared_ptr<Value> &bias, Activation activation);
+
 
 // addition operations for floats directly
 std::shared_ptr<Value> operator+(float a, const std::shared_ptr<Value> &b);
@@ -0,0 +1,142 @@
+/**
+ * Optimization passes over an already built computation graph.
+ */
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "optimize.h"
+
+// every node reachable from root, operands before the nodes that use them
+static std::vector<std::shared_ptr<Value>> post_order(const std::shared_ptr<Value> &root)
+{
+    std::vector<std::shared_ptr<Value>> order;
+    std::unordered_set<const Value *> done;
+    std::vector<std::pair<std::shared_ptr<Value>, size_t>> stack{{root, 0}}; // node, index of the next operand to visit
+    done.insert(root.get());
+    while (!stack.empty())
+    {
+        auto &[v, next] = stack.back();
+        if (next < v->get_prev().size())
+        {
+            const auto &p = v->get_prev()[next++];
+            if (done.insert(p.get()).second)
+            {
+                stack.emplace_back(p, 0);
+            }
+            continue;
+        }
+        order.push_back(v);
+        stack.pop_back();
+    }
+    return order;
+}
+
+static bool is_commutative(const Operation &op)
+{
+    switch (op.kind())
+    {
+    case OpKind::Add:
+    case OpKind::Multiply:
+        return true;
+    default:
+        return false;
+    }
+}
+
+OptimizedGraph optimize_graph(const std::shared_ptr<Value> &root)
+{
+    OptimizedGraph result{nullptr, 0, 0, 0, 0, 0};
+    auto order = post_order(root);
+    result.nodes_before = order.size();
+
+    std::unordered_map<const Value *, std::shared_ptr<Value>> replacement; // original node -> node in the new graph
+    std::unordered_map<uint32_t, std::shared_ptr<Value>> constants;        // bit pattern of the value -> interned constant
+    std::map<std::pair<const Operation *, std::vector<const Value *>>, std::shared_ptr<Value>> expressions;
+
+    auto intern = [&](float data) -> std::shared_ptr<Value> {
+        auto &slot = constants[std::bit_cast<uint32_t>(data)];
+        if (!slot)
+        {
+            slot = make_constant(data);
+        }
+        return slot;
+    };
+
+    std::vector<std::shared_ptr<Value>> operands;
+    std::vector<float> operand_data;
+    for (const auto &v : order)
+    {
+        const auto &op = v->get_operation();
+        if (op == nullptr)
+        {
+            if (!v->is_constant())
+            {
+                replacement[v.get()] = v;
+                continue;
+            }
+            auto &slot = constants[std::bit_cast<uint32_t>(v->get_data())];
+            if (slot)
+            {
+                result.interned++;
+            }
+            else
+            {
+                slot = v;
+            }
+            replacement[v.get()] = slot;
+            continue;
+        }
+
+        operands.clear();
+        bool all_constant = true;
+        for (const auto &p : v->get_prev())
+        {
+            const auto &new_p = replacement.at(p.get());
+            all_constant = all_constant && new_p->is_constant();
+            operands.push_back(new_p);
+        }
+
+        if (all_constant && op->has_kernels())
+        {
+            operand_data.clear();
+            for (const auto &p : operands)
+            {
+                operand_data.push_back(p->get_data());
+            }
+            replacement[v.get()] = intern(op->apply(operand_data));
+            result.folded++;
+            continue;
+        }
+
+        std::vector<const Value *> key;
+        key.reserve(operands.size());
+        for (const auto &p : operands)
+        {
+            key.push_back(p.get());
+        }
+        if (is_commutative(*op))
+        {
+            std::sort(key.begin(), key.end());
+        }
+        auto &existing = expressions[{op.get(), std::move(key)}];
+        if (existing)
+        {
+            replacement[v.get()] = existing;
+            result.merged++;
+            continue;
+        }
+
+        // always a fresh node, so the two graphs never share the grad of an intermediate node
+        existing = op->forward(operands);
+        existing->set_label(v->get_label());
+        replacement[v.get()] = existing;
+    }
+
+    result.root = replacement.at(root.get());
+    result.nodes_after = post_order(result.root).size();
+    return result;
+}
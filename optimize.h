@@ -0,0 +1,33 @@
+/**
+ * Optimization passes over an already built computation graph.
+ */
+#include <cstddef>
+#include <memory>
+#pragma once
+#include "autograd.h"
+
+struct OptimizedGraph
+{
+    std::shared_ptr<Value> root; // root of the simplified graph, computes the same value as the original root
+    size_t nodes_before;         // distinct nodes reachable from the original root
+    size_t nodes_after;          // distinct nodes reachable from the simplified root
+    size_t folded;               // operation nodes replaced by a constant
+    size_t interned;             // duplicate constants merged into one
+    size_t merged;               // common subexpressions merged into one
+};
+
+/**
+ * Returns a simplified copy of the graph reachable from root. In a single pass, from the leaves up:
+ *  - constant folding: an operation whose operands are all constants is evaluated once and replaced by a constant
+ *    (if it has float kernels, see Operation::has_kernels)
+ *  - constant interning: constants with the same value become a single leaf
+ *  - common subexpression elimination: nodes with the same operation on the same operands become a single node
+ *    (operands of + and * are compared in either order)
+ *
+ * e.g. in (exp(2 * n) - 1) / (exp(2 * n) + 1), both exp(2 * n) are computed once and the 2s and 1s are shared.
+ *
+ * Non-constant leaves (inputs, parameters) are kept as is, so backward() on the new root accumulates into the same
+ * Values as backward() on the original. Operation nodes are always rebuilt, so the original graph is not modified and
+ * the two graphs don't share intermediate grads.
+ */
+OptimizedGraph optimize_graph(const std::shared_ptr<Value> &root);
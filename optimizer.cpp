@@ -0,0 +1,69 @@
+/**
+ * Optimizers with per-parameter state (momentum, Adam moments), updating contiguous parameter buffers in one pass.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "optimizer.h"
+#include "profiler.h"
+#include "simd.h"
+
+FusedOptimizer::FusedOptimizer(std::span<float> data, std::span<float> grad) : data(data), grad(grad)
+{
+    if (data.size() != grad.size())
+    {
+        throw std::invalid_argument("Parameter data and grad sizes differ, data size: " + std::to_string(data.size()) + ", grad size: " + std::to_string(grad.size()));
+    }
+}
+
+void FusedOptimizer::zero_grad()
+{
+    ProfileScope profile("zero_grad", "phase", size());
+    if (!grad.empty())
+    {
+        std::memset(grad.data(), 0, grad.size_bytes());
+    }
+}
+
+void FusedOptimizer::copy_state(std::span<const float> from, std::vector<float> &to) const
+{
+    if (from.size() != to.size())
+    {
+        throw std::invalid_argument("Wrong state size for " + get_name() + ", expected " + std::to_string(to.size()) + " floats, got " + std::to_string(from.size()));
+    }
+    std::copy(from.begin(), from.end(), to.begin());
+}
+
+SGDMomentum::SGDMomentum(std::span<float> data, std::span<float> grad, float learning_rate, float momentum, bool nesterov)
+    : FusedOptimizer(data, grad), learning_rate(learning_rate), momentum(momentum), nesterov(nesterov), velocity(data.size(), 0.0f)
+{
+}
+
+void SGDMomentum::step()
+{
+    ProfileScope profile("step", "phase", size());
+    t++;
+    simd::momentum_step(data.data(), grad.data(), velocity.data(), size(), learning_rate, momentum, nesterov);
+}
+
+Adam::Adam(std::span<float> data, std::span<float> grad, float learning_rate, float beta1, float beta2, float eps, float weight_decay)
+    : FusedOptimizer(data, grad), learning_rate(learning_rate), beta1(beta1), beta2(beta2), eps(eps), weight_decay(weight_decay),
+      moments(2 * data.size(), 0.0f)
+{
+}
+
+void Adam::step()
+{
+    ProfileScope profile("step", "phase", size());
+    t++;
+    // the moments start at 0, so early on they underestimate; dividing by (1 - beta^t) corrects for that
+    float step_size = learning_rate / (1.0f - std::pow(beta1, static_cast<float>(t)));
+    float v_scale = 1.0f / std::sqrt(1.0f - std::pow(beta2, static_cast<float>(t)));
+    float l2 = decoupled_weight_decay ? 0.0f : weight_decay;
+    float decay = decoupled_weight_decay ? learning_rate * weight_decay : 0.0f;
+    float *m = moments.data();
+    float *v = moments.data() + size();
+    simd::adam_step(data.data(), grad.data(), m, v, size(), beta1, beta2, step_size, v_scale, eps, l2, decay);
+}
@@ -0,0 +1,112 @@
+/**
+ * Optimizers with per-parameter state (momentum, Adam moments), updating contiguous parameter buffers in one pass.
+ */
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+#pragma once
+#include "parameters.h"
+
+/**
+ * Base for the stateful optimizers. They work on the contiguous data and grad buffers of a ParameterStore (or any two
+ * float spans of the same size), and keep their own state in contiguous buffers of the same size, so that a step is a
+ * single fused, vectorized pass over parameters, grads and state (see the kernels at the end of simd.h).
+ *
+ * Use them like Optimizer:
+ *
+ *     Adam opt(net.parameter_store(), 0.01f);
+ *     opt.zero_grad();
+ *     loss->backward();
+ *     opt.step();
+ */
+class FusedOptimizer
+{
+public:
+    FusedOptimizer(std::span<float> data, std::span<float> grad);
+    virtual ~FusedOptimizer() = default;
+
+    virtual void step() = 0;
+
+    // zeros out all gradients, to be used before a new backward pass
+    void zero_grad();
+
+    size_t size() const { return data.size(); }
+
+    // what a checkpoint needs to resume training: which optimizer, its whole state as one buffer, and the step count
+    virtual std::string get_name() const = 0;
+    virtual std::span<const float> get_state() const = 0;
+    virtual void set_state(std::span<const float> state) = 0; // throws if the size doesn't match get_state()
+    size_t get_step_count() const { return t; }
+    void set_step_count(size_t steps) { t = steps; }
+
+protected:
+    void copy_state(std::span<const float> from, std::vector<float> &to) const;
+
+    std::span<float> data;
+    std::span<float> grad;
+    size_t t = 0; // number of steps taken
+};
+
+// SGD with momentum (velocity = momentum * velocity + grad, data -= lr * velocity), optionally with Nesterov's lookahead
+class SGDMomentum : public FusedOptimizer
+{
+public:
+    SGDMomentum(std::span<float> data, std::span<float> grad, float learning_rate, float momentum = 0.9f, bool nesterov = false);
+    SGDMomentum(ParameterStore &store, float learning_rate, float momentum = 0.9f, bool nesterov = false)
+        : SGDMomentum(store.data(), store.grad(), learning_rate, momentum, nesterov) {}
+
+    void step() override;
+    std::string get_name() const override { return nesterov ? "nesterov" : "sgd_momentum"; }
+    std::span<const float> get_state() const override { return velocity; }
+    void set_state(std::span<const float> state) override { copy_state(state, velocity); }
+
+private:
+    float learning_rate;
+    float momentum;
+    bool nesterov;
+    std::vector<float> velocity;
+};
+
+// Adam, with bias-corrected first and second moments. weight_decay here is the classic L2 term added to the grads.
+class Adam : public FusedOptimizer
+{
+public:
+    Adam(std::span<float> data, std::span<float> grad, float learning_rate = 1e-3f, float beta1 = 0.9f, float beta2 = 0.999f,
+         float eps = 1e-8f, float weight_decay = 0.0f);
+    Adam(ParameterStore &store, float learning_rate = 1e-3f, float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+         float weight_decay = 0.0f)
+        : Adam(store.data(), store.grad(), learning_rate, beta1, beta2, eps, weight_decay) {}
+
+    void step() override;
+    std::string get_name() const override { return decoupled_weight_decay ? "adamw" : "adam"; }
+    std::span<const float> get_state() const override { return moments; }
+    void set_state(std::span<const float> state) override { copy_state(state, moments); }
+
+protected:
+    bool decoupled_weight_decay = false; // AdamW: decay the parameters directly instead of going through the moments
+
+private:
+    float learning_rate;
+    float beta1;
+    float beta2;
+    float eps;
+    float weight_decay;
+    // first moment (mean of the grads) followed by the second moment (mean of the squared grads), size() floats each
+    std::vector<float> moments;
+};
+
+// Adam with decoupled weight decay: data -= lr * weight_decay * data on every step, independently of the moments
+class AdamW : public Adam
+{
+public:
+    AdamW(std::span<float> data, std::span<float> grad, float learning_rate = 1e-3f, float beta1 = 0.9f, float beta2 = 0.999f,
+          float eps = 1e-8f, float weight_decay = 1e-2f)
+        : Adam(data, grad, learning_rate, beta1, beta2, eps, weight_decay)
+    {
+        decoupled_weight_decay = true;
+    }
+    AdamW(ParameterStore &store, float learning_rate = 1e-3f, float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+          float weight_decay = 1e-2f)
+        : AdamW(store.data(), store.grad(), learning_rate, beta1, beta2, eps, weight_decay) {}
+};
@@ -0,0 +1,319 @@
+/**
+ * Multi-threaded execution: a small thread pool, data-parallel and Hogwild training, and a parallel backward pass.
+ */
+#include <algorithm>
+#include <exception>
+#include <unordered_map>
+#include "parallel.h"
+#include "profiler.h"
+#include "simd.h"
+
+using namespace operation;
+
+ThreadPool::ThreadPool(size_t n_threads)
+{
+    for (size_t i = 1; i < std::max<size_t>(n_threads, 1); i++)
+    {
+        workers.emplace_back([this] { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t n_tasks, const std::function<void(size_t)> &fn)
+{
+    if (workers.empty() || n_tasks <= 1)
+    {
+        for (size_t i = 0; i < n_tasks; i++)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        job_size = n_tasks;
+        next_task = 0;
+        tasks_left = n_tasks;
+        error = nullptr;
+        generation++;
+    }
+    work_ready.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return tasks_left == 0; });
+    job = nullptr;
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::run_tasks()
+{
+    while (true)
+    {
+        size_t task;
+        const std::function<void(size_t)> *fn;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job == nullptr || next_task >= job_size)
+            {
+                return;
+            }
+            task = next_task++;
+            fn = job;
+        }
+
+        std::exception_ptr task_error = nullptr;
+        try
+        {
+            (*fn)(task);
+        }
+        catch (...)
+        {
+            task_error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (task_error && !error)
+        {
+            error = task_error; // rethrown on the calling thread
+        }
+        if (--tasks_left == 0)
+        {
+            work_done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::worker_loop()
+{
+    size_t seen_generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping)
+            {
+                return;
+            }
+            seen_generation = generation;
+        }
+        run_tasks();
+    }
+}
+
+
+DataParallel::DataParallel(FullyConnectedNetwork &net, size_t n_threads) : net(net), pool(n_threads)
+{
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+        workers.push_back(std::make_unique<Worker>(net.clone()));
+    }
+}
+
+float DataParallel::forward_backward(std::span<const network_input_t> batch, const sample_loss_fn_t &loss_fn)
+{
+    size_t n_shards = std::min(workers.size(), batch.size());
+    auto &store = net.parameter_store();
+
+    pool.parallel_for(n_shards, [&](size_t shard) {
+        auto &worker = *workers[shard];
+
+        // start from the current parameters, with empty thread-local grads
+        auto &replica_store = worker.replica.parameter_store();
+        std::copy(store.data().begin(), store.data().end(), replica_store.data().begin());
+        replica_store.zero_grad();
+
+        size_t begin = batch.size() * shard / n_shards;
+        size_t end = batch.size() * (shard + 1) / n_shards;
+        {
+            ArenaScope arena_scope(worker.arena);
+            RecordingScope recording(worker.tape);
+
+            // every sample's outputs are held until the shard's backward is done, including the ones loss_fn ignores
+            std::vector<network_output_t> outputs;
+            outputs.reserve(end - begin);
+            std::shared_ptr<Value> shard_loss;
+            for (size_t sample = begin; sample < end; sample++)
+            {
+                const auto &sample_outputs = outputs.emplace_back(worker.replica(batch[sample]));
+                auto sample_loss = loss_fn(sample_outputs, sample);
+                shard_loss = shard_loss ? shard_loss + sample_loss : sample_loss;
+            }
+            worker.loss = shard_loss->get_data();
+            shard_loss->backward();
+        }
+        worker.arena.reset();
+    });
+
+    // reduce the thread-local grads into the shared parameters
+    float total_loss = 0.0f;
+    for (size_t shard = 0; shard < n_shards; shard++)
+    {
+        total_loss += workers[shard]->loss;
+        auto replica_grad = workers[shard]->replica.parameter_store().grad();
+        simd::axpy(1.0f, replica_grad.data(), store.grad().data(), replica_grad.size());
+    }
+    return total_loss;
+}
+
+
+Hogwild::Hogwild(const FullyConnectedNetwork &net, float learning_rate, size_t n_threads)
+    : net(net), optimizer(net.trainable_parameters(), learning_rate), pool(n_threads)
+{
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+        workers.push_back(std::make_unique<Worker>(net.clone()));
+    }
+}
+
+float Hogwild::train_epoch(std::span<const network_input_t> samples, const sample_loss_fn_t &loss_fn)
+{
+    size_t n_shards = std::min(workers.size(), samples.size());
+    const auto &params = net.trainable_parameters();
+
+    pool.parallel_for(n_shards, [&](size_t shard) {
+        auto &worker = *workers[shard];
+        const auto &replica_params = worker.replica.trainable_parameters();
+        worker.loss = 0.0f;
+
+        size_t begin = samples.size() * shard / n_shards;
+        size_t end = samples.size() * (shard + 1) / n_shards;
+        for (size_t sample = begin; sample < end; sample++)
+        {
+            // whatever the other threads have written so far, no need for a consistent snapshot
+            for (size_t i = 0; i < params.size(); i++)
+            {
+                replica_params[i]->set_data(params[i]->atomic_get_data());
+                replica_params[i]->set_grad(0.0f);
+            }
+            {
+                ArenaScope arena_scope(worker.arena);
+                RecordingScope recording(worker.tape);
+
+                // the outputs are held until backward is done, including the ones loss_fn ignores
+                auto outputs = worker.replica(samples[sample]);
+                auto loss = loss_fn(outputs, sample);
+                worker.loss += loss->get_data();
+                loss->backward();
+            }
+            worker.arena.reset();
+            optimizer.atomic_step(replica_params);
+        }
+    });
+
+    float total_loss = 0.0f;
+    for (size_t shard = 0; shard < n_shards; shard++)
+    {
+        total_loss += workers[shard]->loss;
+    }
+    return total_loss;
+}
+
+// levels smaller than this are cheaper to run on the calling thread than to hand out to the pool
+static constexpr size_t MIN_PARALLEL_LEVEL_SIZE = 64;
+
+void parallel_backward(const std::shared_ptr<Value> &root, ThreadPool &pool)
+{
+    ProfileScope profile("backward", "phase");
+    auto sorted = topo_sort(root);
+    profile.add_nodes(sorted.size());
+
+    // level of a node = longest path from root, every operand ends up strictly below all of its users
+    std::unordered_map<const Value *, size_t> level_of;
+    level_of.reserve(sorted.size());
+    level_of[root.get()] = 0;
+    std::vector<std::vector<Value *>> levels;
+    for (const auto &v : sorted)
+    {
+        size_t level = level_of[v.get()];
+        if (v->get_operation() == nullptr)
+        {
+            continue; // leaves have nothing to propagate
+        }
+        if (!v->get_operation()->has_kernels())
+        {
+            // the levels propagate through local_grads, so an operation without it is done serially, in sorted order
+            root->set_grad(1.0f);
+            for (const auto &u : sorted)
+            {
+                if (u->get_operation() != nullptr)
+                {
+                    backward_node(*u);
+                }
+            }
+            return;
+        }
+        if (levels.size() <= level)
+        {
+            levels.resize(level + 1);
+        }
+        levels[level].push_back(v.get());
+        for (const auto &p : v->get_prev())
+        {
+            auto &p_level = level_of[p.get()];
+            p_level = std::max(p_level, level + 1);
+        }
+    }
+
+    root->set_grad(1.0f);
+
+    auto propagate = [](Value *v, std::vector<float> &operand_data, std::vector<float> &operand_grads) {
+        const auto &prev = v->get_prev();
+        operand_data.resize(prev.size());
+        operand_grads.resize(prev.size());
+        for (size_t k = 0; k < prev.size(); k++)
+        {
+            operand_data[k] = prev[k]->get_data();
+        }
+        v->get_operation()->local_grads(operand_data, v->get_data(), operand_grads);
+        float out_grad = v->get_grad();
+        for (size_t k = 0; k < prev.size(); k++)
+        {
+            prev[k]->atomic_add_grad(operand_grads[k] * out_grad);
+        }
+    };
+
+    for (const auto &level : levels)
+    {
+        if (level.size() < MIN_PARALLEL_LEVEL_SIZE || pool.size() == 1)
+        {
+            static thread_local std::vector<float> operand_data, operand_grads;
+            for (Value *v : level)
+            {
+                propagate(v, operand_data, operand_grads);
+            }
+            continue;
+        }
+
+        // a few chunks per thread so uneven nodes (e.g. wide Linear nodes) still balance out
+        size_t n_chunks = std::min(level.size(), pool.size() * 4);
+        pool.parallel_for(n_chunks, [&](size_t chunk) {
+            static thread_local std::vector<float> operand_data, operand_grads;
+            size_t begin = level.size() * chunk / n_chunks;
+            size_t end = level.size() * (chunk + 1) / n_chunks;
+            for (size_t i = begin; i < end; i++)
+            {
+                propagate(level[i], operand_data, operand_grads);
+            }
+        });
+    }
+}
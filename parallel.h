@@ -0,0 +1,136 @@
+/**
+ * Multi-threaded execution: a small thread pool, data-parallel and Hogwild training, and a parallel backward pass.
+ */
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#pragma once
+#include "network.h"
+#include "arena.h"
+#include "tape.h"
+
+/**
+ * Fixed set of worker threads that run parallel_for jobs. The calling thread takes part in every job too, so a pool of
+ * size 1 runs everything inline without any synchronization.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t n_threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // runs fn(i) for every i in [0, n_tasks) and returns once all of them are done. Not reentrant.
+    void parallel_for(size_t n_tasks, const std::function<void(size_t)> &fn);
+
+    size_t size() const { return workers.size() + 1; }
+
+private:
+    void worker_loop();
+    void run_tasks();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    const std::function<void(size_t)> *job = nullptr;
+    size_t job_size = 0;
+    size_t next_task = 0;     // next task index to hand out, guarded by mutex
+    size_t tasks_left = 0;    // tasks not finished yet, guarded by mutex
+    size_t generation = 0;    // bumped for every job so workers can tell a new job from a spurious wakeup
+    bool stopping = false;
+    std::exception_ptr error; // first exception thrown by a task of the current job
+};
+
+/**
+ * Data-parallel forward/backward of a batch over a FullyConnectedNetwork.
+ *
+ * Each thread owns a replica of the network (see FullyConnectedNetwork::clone). Before a step the replicas copy the
+ * current parameter values, then each thread builds and backprops the graph of its shard of the batch into its replica's
+ * parameter grads, which serve as thread-local gradient buffers. Those are summed into the real parameters at the end,
+ * one vectorized pass over each replica's contiguous grad buffer (see ParameterStore), so the result is the same as
+ * calling backward() on the sum of all sample losses.
+ *
+ * Each thread records its graph on its own Tape and allocates it from its own GraphArena.
+ */
+class DataParallel
+{
+public:
+    DataParallel(FullyConnectedNetwork &net, size_t n_threads = std::thread::hardware_concurrency());
+
+    // accumulates d(sum of losses)/d(param) into the grads of net's parameters, and returns the summed loss
+    float forward_backward(std::span<const network_input_t> batch, const sample_loss_fn_t &loss_fn);
+
+    size_t num_threads() const { return pool.size(); }
+
+private:
+    struct Worker
+    {
+        explicit Worker(FullyConnectedNetwork replica) : replica(std::move(replica)) {}
+
+        FullyConnectedNetwork replica;
+        GraphArena arena;
+        Tape tape;
+        float loss = 0.0f;
+    };
+
+    FullyConnectedNetwork &net;
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+/**
+ * Hogwild-style asynchronous SGD over a FullyConnectedNetwork.
+ *
+ * Each thread owns a replica of the network and walks its own shard of the samples, one SGD step per sample: it reads
+ * the current parameter values (relaxed atomic loads), runs forward/backward on its replica, and applies the replica's
+ * grads to the shared parameters with Optimizer::atomic_step. There is no lock and no barrier between steps, so threads
+ * may compute grads on values another thread is in the middle of updating. For small models that is usually cheaper
+ * than synchronizing, and converges about as well.
+ *
+ * Samples (and their input Values) must not be shared between shards, since backward also writes grads into inputs.
+ */
+class Hogwild
+{
+public:
+    Hogwild(const FullyConnectedNetwork &net, float learning_rate, size_t n_threads = std::thread::hardware_concurrency());
+
+    // one pass over samples, updating net's parameters in place. Returns the summed loss of all samples, each measured
+    // right before its own step.
+    float train_epoch(std::span<const network_input_t> samples, const sample_loss_fn_t &loss_fn);
+
+    size_t num_threads() const { return pool.size(); }
+
+private:
+    struct Worker
+    {
+        explicit Worker(FullyConnectedNetwork replica) : replica(std::move(replica)) {}
+
+        FullyConnectedNetwork replica;
+        GraphArena arena;
+        Tape tape;
+        float loss = 0.0f;
+    };
+
+    const FullyConnectedNetwork &net;
+    Optimizer optimizer; // over net's parameters, only atomic_step is used
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+/**
+ * Same result as root->backward() (up to float rounding), but nodes are processed concurrently.
+ *
+ * Nodes are grouped into levels by their longest distance from root. A node only receives grads from nodes at lower
+ * levels, so once a level is done every node in the next level has its final grad, and all of them can propagate at
+ * the same time. Operands shared by several nodes in a level (e.g. a weight used by every sample) are accumulated
+ * with Value::atomic_add_grad. A graph with an operation without float kernels (Operation::has_kernels) is propagated
+ * serially instead.
+ */
+void parallel_backward(const std::shared_ptr<Value> &root, ThreadPool &pool);
@@ -0,0 +1,63 @@
+/**
+ * Contiguous storage for the trainable parameters of a model.
+ */
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "parameters.h"
+
+void ParameterStore::AlignedDelete::operator()(float *p) const
+{
+    ::operator delete[](p, std::align_val_t(ALIGNMENT));
+}
+
+ParameterStore::buffer_t ParameterStore::allocate(size_t n)
+{
+    // round up to whole cache lines, so vectorized loops may safely touch the padding
+    size_t bytes = std::max<size_t>((n * sizeof(float) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT, ALIGNMENT);
+    auto *p = static_cast<float *>(::operator new[](bytes, std::align_val_t(ALIGNMENT)));
+    std::memset(p, 0, bytes);
+    return buffer_t(p);
+}
+
+ParameterStore::ParameterStore(const std::vector<std::shared_ptr<Value>> &parameters)
+    : params(parameters), data_buf(allocate(parameters.size())), grad_buf(allocate(parameters.size()))
+{
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        params[i]->bind_storage(&data_buf[i], &grad_buf[i]);
+    }
+}
+
+ParameterStore::~ParameterStore()
+{
+    for (const auto &param : params)
+    {
+        param->unbind_storage();
+    }
+}
+
+ParameterStore::ParameterStore(ParameterStore &&other) noexcept
+    : params(std::move(other.params)), data_buf(std::move(other.data_buf)), grad_buf(std::move(other.grad_buf))
+{
+    other.params.clear();
+}
+
+ParameterStore &ParameterStore::operator=(ParameterStore &&other) noexcept
+{
+    // our old Values get unbound when other is destroyed
+    std::swap(params, other.params);
+    std::swap(data_buf, other.data_buf);
+    std::swap(grad_buf, other.grad_buf);
+    return *this;
+}
+
+void ParameterStore::zero_grad()
+{
+    if (params.empty())
+    {
+        return;
+    }
+    std::memset(grad_buf.get(), 0, params.size() * sizeof(float));
+}
@@ -0,0 +1,55 @@
+/**
+ * Contiguous storage for the trainable parameters of a model.
+ */
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+#pragma once
+#include "autograd.h"
+
+/**
+ * A ParameterStore keeps the data and grads of a set of parameter Values in two contiguous, cache-line aligned float
+ * arrays, in the order the Values were given. The Values stay the parameters used to build graphs, but become views
+ * into the store (see Value::bind_storage), so
+ *  - zero_grad is a single memset, and an optimizer step is one vectorized pass over data and grad
+ *  - saving or restoring every parameter is a copy of one buffer
+ *
+ * The store keeps the Values alive, and when it is destroyed it moves their current data and grad back into them, so
+ * Values that outlive their store keep working.
+ */
+class ParameterStore
+{
+public:
+    ParameterStore() = default;
+    explicit ParameterStore(const std::vector<std::shared_ptr<Value>> &parameters);
+    ~ParameterStore();
+    ParameterStore(const ParameterStore &) = delete;
+    ParameterStore &operator=(const ParameterStore &) = delete;
+    // the buffers are heap allocated, so moving a store keeps its Values pointing at the right slots
+    ParameterStore(ParameterStore &&other) noexcept;
+    ParameterStore &operator=(ParameterStore &&other) noexcept;
+
+    size_t size() const { return params.size(); }
+    std::span<float> data() { return {data_buf.get(), params.size()}; }
+    std::span<const float> data() const { return {data_buf.get(), params.size()}; }
+    std::span<float> grad() { return {grad_buf.get(), params.size()}; }
+    std::span<const float> grad() const { return {grad_buf.get(), params.size()}; }
+    const std::vector<std::shared_ptr<Value>> &parameters() const { return params; }
+
+    void zero_grad();
+
+    static constexpr size_t ALIGNMENT = 64;
+
+private:
+    struct AlignedDelete
+    {
+        void operator()(float *p) const;
+    };
+    using buffer_t = std::unique_ptr<float[], AlignedDelete>;
+    static buffer_t allocate(size_t n);
+
+    std::vector<std::shared_ptr<Value>> params;
+    buffer_t data_buf;
+    buffer_t grad_buf;
+};
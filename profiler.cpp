@@ -0,0 +1,175 @@
+/**
+ * Built-in instrumentation: call counts, time and node counts per operation and per training phase, with Chrome trace export.
+ */
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include "profiler.h"
+
+namespace profiler
+{
+namespace
+{
+struct Totals
+{
+    const char *category;
+    uint64_t calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t nodes = 0;
+};
+
+struct TraceEvent
+{
+    const char *name;
+    const char *category;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t nodes;
+};
+
+// what one thread recorded. Only that thread writes to it; it stays registered after the thread exits.
+struct ThreadBuffer
+{
+    uint32_t thread_id;
+    std::unordered_map<const char *, Totals> totals; // by name pointer, merged by name content in stats()
+    std::vector<TraceEvent> events;
+    uint64_t dropped_events = 0;
+};
+
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> registry;
+std::atomic<uint64_t> epoch_ns{0}; // trace timestamps are relative to this
+
+ThreadBuffer &thread_buffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto b = std::make_shared<ThreadBuffer>();
+        b->thread_id = static_cast<uint32_t>(registry.size());
+        registry.push_back(b);
+        return b;
+    }();
+    return *buffer;
+}
+} // namespace
+
+void set_enabled(bool enabled)
+{
+    if (enabled)
+    {
+        uint64_t unset = 0;
+        epoch_ns.compare_exchange_strong(unset, now_ns());
+    }
+    enabled_flag.store(enabled, std::memory_order_relaxed);
+}
+
+void reset()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &buffer : registry)
+    {
+        buffer->totals.clear();
+        buffer->events.clear();
+        buffer->dropped_events = 0;
+    }
+    epoch_ns.store(now_ns());
+}
+
+void record(const char *name, const char *category, uint64_t start_ns, uint64_t duration_ns, uint64_t nodes)
+{
+    ThreadBuffer &buffer = thread_buffer();
+    auto [it, inserted] = buffer.totals.try_emplace(name, Totals{category});
+    it->second.calls++;
+    it->second.total_ns += duration_ns;
+    it->second.nodes += nodes;
+    if (buffer.events.size() < MAX_TRACE_EVENTS)
+    {
+        buffer.events.push_back({name, category, start_ns, duration_ns, nodes});
+    }
+    else
+    {
+        buffer.dropped_events++;
+    }
+}
+
+std::vector<ScopeStats> stats()
+{
+    std::map<std::string, ScopeStats> merged;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto &buffer : registry)
+        {
+            for (const auto &[name, totals] : buffer->totals)
+            {
+                ScopeStats &s = merged[name];
+                s.name = name;
+                s.category = totals.category;
+                s.calls += totals.calls;
+                s.total_ns += totals.total_ns;
+                s.nodes += totals.nodes;
+            }
+        }
+    }
+    std::vector<ScopeStats> result;
+    for (auto &[name, s] : merged)
+    {
+        result.push_back(std::move(s));
+    }
+    std::sort(result.begin(), result.end(), [](const ScopeStats &a, const ScopeStats &b) { return a.total_ns > b.total_ns; });
+    return result;
+}
+
+void print_summary(std::ostream &os)
+{
+    auto all = stats();
+    os << std::left << std::setw(28) << "scope" << std::setw(8) << "kind" << std::right << std::setw(12) << "calls" << std::setw(14)
+       << "total ms" << std::setw(14) << "ns/call" << std::setw(14) << "nodes" << "\n";
+    for (const auto &s : all)
+    {
+        os << std::left << std::setw(28) << s.name << std::setw(8) << s.category << std::right << std::setw(12) << s.calls << std::setw(14)
+           << std::fixed << std::setprecision(3) << s.total_ns / 1e6 << std::setw(14) << std::setprecision(1)
+           << static_cast<double>(s.total_ns) / s.calls << std::setw(14) << s.nodes << "\n";
+    }
+    os << std::defaultfloat << std::setprecision(6);
+}
+
+void write_chrome_trace(const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        throw std::runtime_error("Could not open " + path + " for writing the trace");
+    }
+    uint64_t epoch = epoch_ns.load();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    // timestamps and durations are in microseconds
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    bool first = true;
+    for (const auto &buffer : registry)
+    {
+        for (const auto &e : buffer->events)
+        {
+            double ts = e.start_ns >= epoch ? (e.start_ns - epoch) / 1e3 : 0.0;
+            out << (first ? "\n" : ",\n") << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"ts\": " << ts
+                << ", \"dur\": " << e.duration_ns / 1e3 << ", \"pid\": 1, \"tid\": " << buffer->thread_id << ", \"args\": {\"nodes\": " << e.nodes << "}}";
+            first = false;
+        }
+        if (buffer->dropped_events > 0)
+        {
+            out << (first ? "\n" : ",\n") << "{\"name\": \"dropped " << buffer->dropped_events << " events\", \"ph\": \"i\", \"s\": \"t\", \"ts\": 0, \"pid\": 1, \"tid\": "
+                << buffer->thread_id << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    if (!out)
+    {
+        throw std::runtime_error("Failed writing the trace to " + path);
+    }
+}
+} // namespace profiler
@@ -0,0 +1,119 @@
+/**
+ * Built-in instrumentation: call counts, time and node counts per operation and per training phase, with Chrome trace export.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#pragma once
+#include "constants.h"
+
+/**
+ * Every operation's forward/backward and every phase of a training step (forward, sort, backward, step, zero_grad)
+ * is wrapped in a ProfileScope. With PROFILING false in constants.h the scopes compile to nothing; otherwise they cost
+ * one relaxed load while the profiler is off, and record a call, its duration and its node count while it is on:
+ *
+ *     profiler::set_enabled(true);
+ *     ... training steps ...
+ *     profiler::set_enabled(false);
+ *     profiler::print_summary(std::cout);
+ *     profiler::write_chrome_trace("trace.json"); // open in https://ui.perfetto.dev or chrome://tracing
+ *
+ * Times are inclusive (a backward includes the sort it runs, and the op backwards it calls). Each thread records into
+ * its own buffers, so profiling parallel training is fine, but stats(), reset() and the exports must not run while
+ * profiled work is running on other threads.
+ */
+namespace profiler
+{
+// totals for one scope name
+struct ScopeStats
+{
+    std::string name;     // e.g. "Tanh::forward" or "backward"
+    std::string category; // "op" for operations, "phase" for the phases of a step
+    uint64_t calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t nodes = 0; // graph nodes (or parameters, for step/zero_grad) the scope created or went over; operands for an op
+};
+
+// the trace keeps the first MAX_TRACE_EVENTS scopes of each thread, the stats keep counting after that
+inline constexpr size_t MAX_TRACE_EVENTS = 1 << 20;
+
+inline std::atomic<bool> enabled_flag{false};
+
+inline bool enabled()
+{
+    return enabled_flag.load(std::memory_order_relaxed);
+}
+void set_enabled(bool enabled);
+
+// drops everything recorded so far, on every thread
+void reset();
+
+// totals per scope name over all threads, slowest first
+std::vector<ScopeStats> stats();
+void print_summary(std::ostream &os);
+
+// writes every recorded scope as a Chrome trace_event JSON file, one track per thread
+void write_chrome_trace(const std::string &path);
+
+inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// adds one finished scope to the calling thread's buffers. name and category must be string literals (kept by pointer).
+void record(const char *name, const char *category, uint64_t start_ns, uint64_t duration_ns, uint64_t nodes);
+} // namespace profiler
+
+// RAII timer around a profiled region, see profiler above
+class ProfileScope
+{
+public:
+    ProfileScope(const char *name, const char *category, uint64_t nodes = 0)
+    {
+        if constexpr (PROFILING)
+        {
+            if (profiler::enabled())
+            {
+                this->name = name;
+                this->category = category;
+                this->nodes = nodes;
+                start = profiler::now_ns();
+            }
+        }
+    }
+    ~ProfileScope()
+    {
+        if constexpr (PROFILING)
+        {
+            if (name != nullptr)
+            {
+                profiler::record(name, category, start, profiler::now_ns() - start, nodes);
+            }
+        }
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    // for counts only known once the work is done
+    void add_nodes(uint64_t n)
+    {
+        if constexpr (PROFILING)
+        {
+            nodes += n;
+        }
+    }
+
+private:
+    const char *name = nullptr; // null when the profiler was off as the scope started
+    const char *category = nullptr;
+    uint64_t start = 0;
+    uint64_t nodes = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// profiles the rest of the enclosing block, for regions without a node count
+#define PROFILE_SCOPE(name, category) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name, category)
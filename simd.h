@@ -0,0 +1,332 @@
+/**
+ * Small vectorized float kernels shared by the fused operations and the tensor path.
+ *
+ * The kernel is picked at compile time: AVX2+FMA when the compiler targets it (e.g. -mavx2 -mfma or -march=native),
+ * otherwise SSE (always available on x86-64), otherwise a plain scalar loop (e.g. on ARM).
+ *
+ * Vector loops stop at n rounded down to a whole number of vectors (`i < n - n % 8` rather than `i + 8 <= n`, the
+ * same iterations), so that GCC can tell the scalar tail never overruns when n is a compile-time constant, as in
+ * static_network.h.
+ */
+#include <cstddef>
+#pragma once
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE 1
+#endif
+#include <algorithm>
+#include <cmath>
+
+namespace simd {
+
+// sum of a[i] * b[i]
+inline float dot(const float *a, const float *b, size_t n)
+{
+    size_t i = 0;
+    float total = 0.0f;
+#if defined(SIMD_AVX2)
+    // two accumulators to hide the FMA latency
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i < n - n % 16; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i < n - n % 8; i += 8)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+    total = _mm_cvtss_f32(half);
+#elif defined(SIMD_SSE)
+    __m128 acc = _mm_setzero_ps();
+    for (; i < n - n % 4; i += 4)
+    {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    total = _mm_cvtss_f32(acc);
+#endif
+    for (; i < n; i++)
+    {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+// y[i] += alpha * x[i]
+inline void axpy(float alpha, const float *x, float *y, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    __m256 a = _mm256_set1_ps(alpha);
+    for (; i < n - n % 8; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+#elif defined(SIMD_SSE)
+    __m128 a = _mm_set1_ps(alpha);
+    for (; i < n - n % 4; i += 4)
+    {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(a, _mm_loadu_ps(x + i))));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        y[i] += alpha * x[i];
+    }
+}
+
+// out[i] = alpha * x[i]
+inline void scale(float alpha, const float *x, float *out, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    __m256 a = _mm256_set1_ps(alpha);
+    for (; i < n - n % 8; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(a, _mm256_loadu_ps(x + i)));
+    }
+#elif defined(SIMD_SSE)
+    __m128 a = _mm_set1_ps(alpha);
+    for (; i < n - n % 4; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_mul_ps(a, _mm_loadu_ps(x + i)));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = alpha * x[i];
+    }
+}
+
+/**
+ * Elementwise activations over a buffer. They use a polynomial exp (Cephes expf: range reduction to
+ * e^x = 2^n * e^r with |r| <= ln(2)/2, then a degree 5 polynomial for e^r), accurate to a few ulp over
+ * the clamped input range, so large inputs saturate instead of overflowing.
+ */
+#if defined(SIMD_AVX2)
+inline __m256 exp_ps(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2n));
+}
+#elif defined(SIMD_SSE)
+inline __m128 exp_ps(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.3f)), _mm_set1_ps(88.3f));
+    // round to nearest without SSE4.1: cvtps_epi32 uses the current rounding mode (nearest by default)
+    __m128i n_int = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)));
+    __m128 n = _mm_cvtepi32_ps(n_int);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+    __m128 p = _mm_set1_ps(1.9875691500e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), _mm_add_ps(r, _mm_set1_ps(1.0f)));
+    __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(n_int, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(pow2n));
+}
+#endif
+
+// numerically stable scalar tanh: tanh(|x|) = -t / (t + 2) with t = expm1(-2|x|) in (-1, 0], so nothing overflows
+inline float tanh_stable(float x)
+{
+    float t = std::expm1(-2.0f * std::fabs(x));
+    return std::copysign(-t / (t + 2.0f), x);
+}
+
+// out[i] = tanh(in[i]), saturating to +-1 for large inputs
+inline void tanh(const float *in, float *out, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    for (; i < n - n % 8; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(in + i);
+        __m256 sign = _mm256_and_ps(x, sign_mask);
+        __m256 ax = _mm256_andnot_ps(sign_mask, x);
+        // tanh(|x|) = (1 - e^{-2|x|}) / (1 + e^{-2|x|})
+        __m256 t = exp_ps(_mm256_mul_ps(ax, _mm256_set1_ps(-2.0f)));
+        __m256 y = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), t), _mm256_add_ps(_mm256_set1_ps(1.0f), t));
+        // near zero 1 - t cancels, use the series x - x^3/3 + 2x^5/15 instead
+        __m256 x2 = _mm256_mul_ps(ax, ax);
+        __m256 series = _mm256_fmadd_ps(_mm256_fmadd_ps(x2, _mm256_set1_ps(2.0f / 15.0f), _mm256_set1_ps(-1.0f / 3.0f)), _mm256_mul_ps(x2, ax), ax);
+        y = _mm256_blendv_ps(y, series, _mm256_cmp_ps(ax, _mm256_set1_ps(0.0625f), _CMP_LT_OQ));
+        _mm256_storeu_ps(out + i, _mm256_or_ps(y, sign));
+    }
+#elif defined(SIMD_SSE)
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    for (; i < n - n % 4; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(in + i);
+        __m128 sign = _mm_and_ps(x, sign_mask);
+        __m128 ax = _mm_andnot_ps(sign_mask, x);
+        __m128 t = exp_ps(_mm_mul_ps(ax, _mm_set1_ps(-2.0f)));
+        __m128 y = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(1.0f), t), _mm_add_ps(_mm_set1_ps(1.0f), t));
+        __m128 x2 = _mm_mul_ps(ax, ax);
+        __m128 series = _mm_add_ps(ax, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(x2, _mm_set1_ps(2.0f / 15.0f)), _mm_set1_ps(-1.0f / 3.0f)), _mm_mul_ps(x2, ax)));
+        __m128 small = _mm_cmplt_ps(ax, _mm_set1_ps(0.0625f));
+        y = _mm_or_ps(_mm_and_ps(small, series), _mm_andnot_ps(small, y));
+        _mm_storeu_ps(out + i, _mm_or_ps(y, sign));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = tanh_stable(in[i]);
+    }
+}
+
+// out[i] = 1 / (1 + e^{-in[i]})
+inline void sigmoid(const float *in, float *out, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    const __m256 one = _mm256_set1_ps(1.0f);
+    for (; i < n - n % 8; i += 8)
+    {
+        __m256 e = exp_ps(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+    }
+#elif defined(SIMD_SSE)
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i < n - n % 4; i += 4)
+    {
+        __m128 e = exp_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(in + i)));
+        _mm_storeu_ps(out + i, _mm_div_ps(one, _mm_add_ps(one, e)));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = 1.0f / (1.0f + std::exp(-in[i]));
+    }
+}
+
+// out[i] = max(in[i], 0), plain enough for the compiler to vectorize
+inline void relu(const float *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = std::max(in[i], 0.0f);
+    }
+}
+
+/**
+ * Fused optimizer updates: parameters, grads and optimizer state are read and written in a single pass, see optimizer.h.
+ */
+
+// velocity = momentum * velocity + grad, then data -= lr * velocity, or data -= lr * (grad + momentum * velocity) for Nesterov
+inline void momentum_step(float *data, const float *grad, float *velocity, size_t n, float lr, float momentum, bool nesterov)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    __m256 mu = _mm256_set1_ps(momentum);
+    __m256 rate = _mm256_set1_ps(lr);
+    for (; i < n - n % 8; i += 8)
+    {
+        __m256 g = _mm256_loadu_ps(grad + i);
+        __m256 vel = _mm256_fmadd_ps(mu, _mm256_loadu_ps(velocity + i), g);
+        _mm256_storeu_ps(velocity + i, vel);
+        __m256 update = nesterov ? _mm256_fmadd_ps(mu, vel, g) : vel;
+        _mm256_storeu_ps(data + i, _mm256_fnmadd_ps(rate, update, _mm256_loadu_ps(data + i)));
+    }
+#elif defined(SIMD_SSE)
+    __m128 mu = _mm_set1_ps(momentum);
+    __m128 rate = _mm_set1_ps(lr);
+    for (; i < n - n % 4; i += 4)
+    {
+        __m128 g = _mm_loadu_ps(grad + i);
+        __m128 vel = _mm_add_ps(_mm_mul_ps(mu, _mm_loadu_ps(velocity + i)), g);
+        _mm_storeu_ps(velocity + i, vel);
+        __m128 update = nesterov ? _mm_add_ps(_mm_mul_ps(mu, vel), g) : vel;
+        _mm_storeu_ps(data + i, _mm_sub_ps(_mm_loadu_ps(data + i), _mm_mul_ps(rate, update)));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        velocity[i] = momentum * velocity[i] + grad[i];
+        float update = nesterov ? grad[i] + momentum * velocity[i] : velocity[i];
+        data[i] -= lr * update;
+    }
+}
+
+/**
+ * One Adam step, per element:
+ *     g = grad + l2 * data
+ *     m = beta1 * m + (1 - beta1) * g
+ *     v = beta2 * v + (1 - beta2) * g^2
+ *     data = data * (1 - decay) - step_size * m / (sqrt(v) * v_scale + eps)
+ * where the bias corrections are folded into step_size = lr / (1 - beta1^t) and v_scale = 1 / sqrt(1 - beta2^t).
+ * l2 is Adam's (coupled) weight decay, decay is AdamW's decoupled one (lr * weight_decay).
+ */
+inline void adam_step(float *data, const float *grad, float *m, float *v, size_t n, float beta1, float beta2, float step_size,
+                      float v_scale, float eps, float l2, float decay)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    __m256 b1 = _mm256_set1_ps(beta1), c1 = _mm256_set1_ps(1.0f - beta1);
+    __m256 b2 = _mm256_set1_ps(beta2), c2 = _mm256_set1_ps(1.0f - beta2);
+    __m256 step = _mm256_set1_ps(step_size), vs = _mm256_set1_ps(v_scale), epsilon = _mm256_set1_ps(eps);
+    __m256 l2_coef = _mm256_set1_ps(l2), keep = _mm256_set1_ps(1.0f - decay);
+    for (; i < n - n % 8; i += 8)
+    {
+        __m256 p = _mm256_loadu_ps(data + i);
+        __m256 g = _mm256_fmadd_ps(l2_coef, p, _mm256_loadu_ps(grad + i));
+        __m256 mi = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i), _mm256_mul_ps(c1, g));
+        __m256 vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i), _mm256_mul_ps(c2, _mm256_mul_ps(g, g)));
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+        __m256 denom = _mm256_fmadd_ps(_mm256_sqrt_ps(vi), vs, epsilon);
+        _mm256_storeu_ps(data + i, _mm256_fnmadd_ps(step, _mm256_div_ps(mi, denom), _mm256_mul_ps(p, keep)));
+    }
+#elif defined(SIMD_SSE)
+    __m128 b1 = _mm_set1_ps(beta1), c1 = _mm_set1_ps(1.0f - beta1);
+    __m128 b2 = _mm_set1_ps(beta2), c2 = _mm_set1_ps(1.0f - beta2);
+    __m128 step = _mm_set1_ps(step_size), vs = _mm_set1_ps(v_scale), epsilon = _mm_set1_ps(eps);
+    __m128 l2_coef = _mm_set1_ps(l2), keep = _mm_set1_ps(1.0f - decay);
+    for (; i < n - n % 4; i += 4)
+    {
+        __m128 p = _mm_loadu_ps(data + i);
+        __m128 g = _mm_add_ps(_mm_loadu_ps(grad + i), _mm_mul_ps(l2_coef, p));
+        __m128 mi = _mm_add_ps(_mm_mul_ps(b1, _mm_loadu_ps(m + i)), _mm_mul_ps(c1, g));
+        __m128 vi = _mm_add_ps(_mm_mul_ps(b2, _mm_loadu_ps(v + i)), _mm_mul_ps(c2, _mm_mul_ps(g, g)));
+        _mm_storeu_ps(m + i, mi);
+        _mm_storeu_ps(v + i, vi);
+        __m128 denom = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(vi), vs), epsilon);
+        _mm_storeu_ps(data + i, _mm_sub_ps(_mm_mul_ps(p, keep), _mm_mul_ps(step, _mm_div_ps(mi, denom))));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        float g = grad[i] + l2 * data[i];
+        m[i] = beta1 * m[i] + (1.0f - beta1) * g;
+        v[i] = beta2 * v[i] + (1.0f - beta2) * g * g;
+        data[i] = data[i] * (1.0f - decay) - step_size * m[i] / (std::sqrt(v[i]) * v_scale + eps);
+    }
+}
+
+}
@@ -0,0 +1,223 @@
+/**
+ * Fully connected networks whose shape is fixed at compile time.
+ */
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdlib>
+#include <span>
+#include <utility>
+#pragma once
+#include "activation.h"
+#include "parameters.h"
+#include "simd.h"
+
+/**
+ * StaticFCNetwork<3, 4, 4, 1> is the network FullyConnectedNetwork(3, {4, 4, 1}) describes, with every size a
+ * constant: NumInputs inputs, then one fully connected layer per entry of Widths. Parameters and grads are std::arrays
+ * inside the object, laid out like FullyConnectedNetwork::parameter_store() (layer after layer, per neuron its weights
+ * then its bias), and forward and backward run straight on floats, without building a graph. Since every loop bound is
+ * a constant, the compiler can unroll and vectorize each layer for its exact size, and nothing is checked or allocated
+ * per call. Large networks make large objects, so those are better kept on the heap (std::make_unique).
+ *
+ * Training works with the fused optimizers through the parameter buffers:
+ *
+ *     StaticFCNetwork<3, 4, 4, 1> net;
+ *     Adam opt(net.parameter_data(), net.parameter_grads(), 0.01f);
+ *     for (...) {
+ *         opt.zero_grad();
+ *         for (size_t i = 0; i < batch; i++)
+ *             net.forward_backward(x[i], y[i]);   // grads are accumulated over the batch
+ *         opt.step();
+ *     }
+ *
+ * Weights are drawn with rand() in the same order as FullyConnectedNetwork, so after the same srand() both start from
+ * the same parameters. Outputs and grads match it up to float rounding: activations are computed a layer at a time with
+ * the vectorized kernels of the tensor path, instead of one scalar call per neuron.
+ */
+template <size_t NumInputs, size_t... Widths>
+class StaticFCNetwork
+{
+    static_assert(sizeof...(Widths) > 0, "A network needs at least one layer");
+    static_assert(NumInputs > 0 && ((Widths > 0) && ...), "Layer sizes must be positive");
+
+public:
+    static constexpr size_t NUM_LAYERS = sizeof...(Widths);
+    // the number of inputs, followed by the size of every layer
+    static constexpr std::array<size_t, NUM_LAYERS + 1> WIDTHS{NumInputs, Widths...};
+    static constexpr size_t NUM_INPUTS = NumInputs;
+    static constexpr size_t NUM_OUTPUTS = WIDTHS[NUM_LAYERS];
+
+private:
+    // where each layer's parameters start, and the total as the last entry
+    static constexpr std::array<size_t, NUM_LAYERS + 1> PARAMETER_OFFSETS = [] {
+        std::array<size_t, NUM_LAYERS + 1> offsets{};
+        for (size_t l = 0; l < NUM_LAYERS; l++)
+        {
+            offsets[l + 1] = offsets[l] + WIDTHS[l + 1] * (WIDTHS[l] + 1);
+        }
+        return offsets;
+    }();
+    // where each layer's outputs start in a buffer holding the inputs and every layer's outputs, and the total
+    static constexpr std::array<size_t, NUM_LAYERS + 2> UNIT_OFFSETS = [] {
+        std::array<size_t, NUM_LAYERS + 2> offsets{};
+        for (size_t l = 0; l <= NUM_LAYERS; l++)
+        {
+            offsets[l + 1] = offsets[l] + WIDTHS[l];
+        }
+        return offsets;
+    }();
+    using units_t = std::array<float, UNIT_OFFSETS[NUM_LAYERS + 1]>;
+
+public:
+    static constexpr size_t NUM_PARAMETERS = PARAMETER_OFFSETS[NUM_LAYERS];
+    using input_t = std::array<float, NUM_INPUTS>;
+    using output_t = std::array<float, NUM_OUTPUTS>;
+
+    // activations picks the activation of each layer, tanh everywhere by default (as FullyConnectedNetwork)
+    explicit StaticFCNetwork(const std::array<Activation, NUM_LAYERS> &activations = all_tanh()) : activations(activations)
+    {
+        float *p = data.data();
+        for (size_t l = 0; l < NUM_LAYERS; l++)
+        {
+            for (size_t j = 0; j < WIDTHS[l + 1]; j++)
+            {
+                // rand number between -1 and 1 for the weights, 0 for the bias, as in the Neuron constructor
+                for (size_t i = 0; i < WIDTHS[l]; i++)
+                {
+                    *p++ = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 2 - 1;
+                }
+                *p++ = 0.0f;
+            }
+        }
+        grad.fill(0.0f);
+    }
+
+    // inference, same outputs as FullyConnectedNetwork::predict up to float rounding
+    output_t predict(const input_t &x) const
+    {
+        units_t units;
+        forward(x, units);
+        output_t out;
+        std::copy_n(units.begin() + UNIT_OFFSETS[NUM_LAYERS], NUM_OUTPUTS, out.begin());
+        return out;
+    }
+
+    /**
+     * One training sample: forward, then backward from the grads of the outputs, which loss_fn writes. The parameter
+     * grads are accumulated (call zero_grad, or the optimizer's, between steps). loss_fn is called as
+     * loss_fn(const output_t &outputs, output_t &output_grads) and returns the loss, which is passed through.
+     */
+    template <class LossFn>
+        requires std::invocable<LossFn &, const output_t &, output_t &>
+    float forward_backward(const input_t &x, LossFn &&loss_fn)
+    {
+        units_t units;
+        forward(x, units);
+        const float *outputs = units.data() + UNIT_OFFSETS[NUM_LAYERS];
+        output_t out, out_grad{};
+        std::copy_n(outputs, NUM_OUTPUTS, out.begin());
+        float loss = loss_fn(std::as_const(out), out_grad);
+
+        units_t unit_grads{};
+        std::copy(out_grad.begin(), out_grad.end(), unit_grads.begin() + UNIT_OFFSETS[NUM_LAYERS]);
+        backward(units, unit_grads, std::make_index_sequence<NUM_LAYERS>{});
+        return loss;
+    }
+
+    // same, for the squared error sum_i (outputs[i] - target[i])^2
+    float forward_backward(const input_t &x, const output_t &target)
+    {
+        return forward_backward(x, [&](const output_t &out, output_t &out_grad) {
+            float loss = 0.0f;
+            for (size_t i = 0; i < NUM_OUTPUTS; i++)
+            {
+                float diff = out[i] - target[i];
+                loss += diff * diff;
+                out_grad[i] = 2.0f * diff;
+            }
+            return loss;
+        });
+    }
+
+    // the parameters and their grads, one float each, in the order described above (what the fused optimizers and
+    // checkpoints work on)
+    std::span<float, NUM_PARAMETERS> parameter_data() { return data; }
+    std::span<const float, NUM_PARAMETERS> parameter_data() const { return data; }
+    std::span<float, NUM_PARAMETERS> parameter_grads() { return grad; }
+    std::span<const float, NUM_PARAMETERS> parameter_grads() const { return grad; }
+    void zero_grad() { grad.fill(0.0f); }
+
+    static constexpr std::span<const size_t> get_layer_widths() { return WIDTHS; }
+    const std::array<Activation, NUM_LAYERS> &get_activations() const { return activations; }
+
+private:
+    static constexpr std::array<Activation, NUM_LAYERS> all_tanh()
+    {
+        std::array<Activation, NUM_LAYERS> all{};
+        all.fill(Activation::Tanh);
+        return all;
+    }
+
+    void forward(const input_t &x, units_t &units) const
+    {
+        std::copy(x.begin(), x.end(), units.begin());
+        forward(units, std::make_index_sequence<NUM_LAYERS>{});
+    }
+
+    template <size_t... L>
+    void forward(units_t &units, std::index_sequence<L...>) const
+    {
+        (forward_layer<L>(units), ...);
+    }
+
+    template <size_t L>
+    void forward_layer(units_t &units) const
+    {
+        constexpr size_t n_in = WIDTHS[L], n_out = WIDTHS[L + 1];
+        const float *in = units.data() + UNIT_OFFSETS[L];
+        float *out = units.data() + UNIT_OFFSETS[L + 1];
+        const float *w = data.data() + PARAMETER_OFFSETS[L];
+        for (size_t j = 0; j < n_out; j++, w += n_in + 1)
+        {
+            out[j] = simd::dot(w, in, n_in) + w[n_in];
+        }
+        // the whole layer at once, with the vectorized kernels of the tensor path
+        activate(activations[L], out, out, n_out);
+    }
+
+    // layers from the last to the first
+    template <size_t... L>
+    void backward(const units_t &units, units_t &unit_grads, std::index_sequence<L...>)
+    {
+        (backward_layer<NUM_LAYERS - 1 - L>(units, unit_grads), ...);
+    }
+
+    template <size_t L>
+    void backward_layer(const units_t &units, units_t &unit_grads)
+    {
+        constexpr size_t n_in = WIDTHS[L], n_out = WIDTHS[L + 1];
+        const float *in = units.data() + UNIT_OFFSETS[L];
+        const float *out = units.data() + UNIT_OFFSETS[L + 1];
+        const float *out_grad = unit_grads.data() + UNIT_OFFSETS[L + 1];
+        [[maybe_unused]] float *in_grad = unit_grads.data() + UNIT_OFFSETS[L];
+        const float *w = data.data() + PARAMETER_OFFSETS[L];
+        float *w_grad = grad.data() + PARAMETER_OFFSETS[L];
+        for (size_t j = 0; j < n_out; j++, w += n_in + 1, w_grad += n_in + 1)
+        {
+            // as LinearActivation::backward: grad w.r.t the pre-activation, then d/dw_i = x_i and d/dx_i = w_i
+            float pre_grad = activation_derivative(activations[L], out[j]) * out_grad[j];
+            simd::axpy(pre_grad, in, w_grad, n_in);
+            w_grad[n_in] += pre_grad;
+            if constexpr (L > 0) // the grads of the network inputs aren't needed
+            {
+                simd::axpy(pre_grad, w, in_grad, n_in);
+            }
+        }
+    }
+
+    alignas(ParameterStore::ALIGNMENT) std::array<float, NUM_PARAMETERS> data;
+    alignas(ParameterStore::ALIGNMENT) std::array<float, NUM_PARAMETERS> grad;
+    std::array<Activation, NUM_LAYERS> activations;
+};
@@ -0,0 +1,165 @@
+/**
+ * Linear recording of graph nodes (a Wengert list), so backward can skip the topological sort.
+ */
+#include <span>
+#include <vector>
+#include "tape.h"
+#include "autograd.h"
+#include "constants.h"
+
+static thread_local Tape *current_tape = nullptr;
+
+Tape *Tape::current()
+{
+    return current_tape;
+}
+
+/**
+ * Reachable nodes with an operation that the walk over the tape didn't meet, since they aren't on it: built before
+ * recording started, or consumed by an earlier backward. They are older than every node on the tape, so all of their
+ * users there are done by now, and what is left is propagated in topological order.
+ */
+static size_t propagate_off_tape(Value &root, uint64_t epoch, bool retain_graph)
+{
+    // the stamped nodes the walk didn't propagate through (traversal counter 0), found by going down from root through
+    // the ones it did (1, then 2 once expanded here)
+    std::vector<std::shared_ptr<Value>> off_tape;
+    std::vector<Value *> stack{&root};
+    root.traversal_counter() = 2;
+    while (!stack.empty())
+    {
+        Value *v = stack.back();
+        stack.pop_back();
+        for (const auto &p : v->get_prev())
+        {
+            if (!p->was_visited(epoch))
+            {
+                continue; // a leaf
+            }
+            uint32_t &state = p->traversal_counter();
+            if (state == 1)
+            {
+                state = 2;
+                stack.push_back(p.get());
+            }
+            else if (state == 0)
+            {
+                state = 3;
+                off_tape.push_back(p);
+            }
+        }
+    }
+
+    size_t n_nodes = 0;
+    for (const auto &v : topo_sort(off_tape))
+    {
+        if (v->get_operation() == nullptr)
+        {
+            continue;
+        }
+        backward_node(*v);
+        n_nodes++;
+        if (!retain_graph)
+        {
+            v->release_operands();
+        }
+    }
+    return n_nodes;
+}
+
+size_t Tape::backward(Value &root, bool retain_graph)
+{
+    // the root is almost always the last node recorded (e.g. the loss), so search from the end
+    size_t end = nodes.size();
+    while (end > 0 && nodes[end - 1].get() != &root)
+    {
+        end--;
+    }
+    if (end == 0)
+    {
+        return 0;
+    }
+
+    // only nodes reachable from root are propagated through: root gets a fresh stamp, and every node visited passes it
+    // on to its operands. All users of a node come after it on the tape, so by the time the walk gets to a node, it is
+    // stamped if it is reachable at all. pending counts the stamped nodes not visited yet, so the walk stops as soon as
+    // the whole graph is done, wherever it starts on the tape.
+    uint64_t epoch = new_traversal_epoch();
+    root.mark_visited(epoch);
+    root.set_grad(1.0f);
+    size_t pending = 1;
+    size_t n_nodes = 0;
+    size_t first = end; // the earliest node visited
+    for (size_t i = end; i-- > 0 && pending > 0;)
+    {
+        Value *v = nodes[i].get();
+        if (!v->was_visited(epoch))
+        {
+            continue; // not part of this graph, e.g. an unused output or a temporary dropped while building the loss
+        }
+        DBG(
+        std::cout << "Backpropagating (tape) through Value node with data=" << v->get_data() << ", grad=" << v->get_grad() << ", operation=" << v->get_operation()->get_name() << "\n";
+        );
+        backward_node(*v);
+        for (const auto &p : v->get_prev())
+        {
+            // leaves have nothing to propagate, and aren't stamped (parameters may be shared with other threads' graphs)
+            if (p->get_operation() != nullptr && p->mark_visited(epoch))
+            {
+                pending++;
+            }
+        }
+        v->traversal_counter() = 1; // done, see propagate_off_tape
+        pending--;
+        n_nodes++;
+        first = i;
+    }
+    if (pending > 0)
+    {
+        n_nodes += propagate_off_tape(root, epoch, retain_graph);
+    }
+
+    // operands are only released once everything is propagated, since propagate_off_tape may still need to walk them
+    if (!retain_graph)
+    {
+        for (size_t i = first; i < end; i++)
+        {
+            if (nodes[i]->was_visited(epoch))
+            {
+                nodes[i]->release_operands();
+            }
+        }
+    }
+    // root and everything before it is done with: nodes of this graph, or of none reachable from a later root
+    nodes.erase(nodes.begin(), nodes.begin() + end);
+    return n_nodes;
+}
+
+void Tape::backward()
+{
+    // reverse creation order visits every node after all of the nodes that use it
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        Value *v = nodes[i].get();
+        if (v->get_operation() == nullptr)
+        {
+            continue; // released by an earlier backward(false)
+        }
+        DBG(
+        std::cout << "Backpropagating (tape) through Value node with data=" << v->get_data() << ", grad=" << v->get_grad() << ", operation=" << v->get_operation()->get_name() << "\n";
+        );
+        backward_node(*v);
+    }
+    nodes.clear();
+}
+
+RecordingScope::RecordingScope(Tape &tape) : tape(tape), previous(current_tape)
+{
+    current_tape = &tape;
+}
+
+RecordingScope::~RecordingScope()
+{
+    tape.clear();
+    current_tape = previous;
+}
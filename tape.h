@@ -0,0 +1,70 @@
+/**
+ * Linear recording of graph nodes (a Wengert list), so backward can skip the topological sort.
+ */
+#include <cstddef>
+#include <memory>
+#include <vector>
+#pragma once
+
+class Value;
+
+/**
+ * A Tape stores every node created by an operation, in creation order, while a RecordingScope on it is active.
+ *
+ * An operation's output is always created after its operands, so creation order is already a valid topological order.
+ * Backward from a recorded node just walks the tape in reverse: no hashing, no recursion and no allocation.
+ *
+ * The tape holds a reference to each node until the node is consumed by a backward or the tape is cleared, so nodes
+ * dropped along the way (an unused network output, a temporary in a loss) stay valid while they are on it. Backward
+ * only propagates through the nodes reachable from its root, and then drops its root and everything recorded before
+ * it, so a second backward in the same scope doesn't replay the first graph. Nodes from the tape still go back to
+ * their GraphArena, so open the RecordingScope inside the ArenaScope, as in the example in arena.h.
+ * Reuse one Tape across steps so its buffer is only grown once.
+ */
+class Tape
+{
+public:
+    void record(std::shared_ptr<Value> node) { nodes.push_back(std::move(node)); }
+
+    // forget all recorded nodes, keeping the buffer for the next step
+    void clear() { nodes.clear(); }
+
+    size_t size() const { return nodes.size(); }
+
+    // propagate gradients from root by walking the tape in reverse, and return the number of nodes propagated through.
+    // Returns 0 (and does nothing) if root was not recorded on this tape.
+    // retain_graph = false releases each node's operands once it is done, as in Value::backward.
+    // Nodes reachable from root that are not on the tape (built before recording started, or consumed by an earlier
+    // backward) are propagated through in topological order once the tape is done.
+    size_t backward(Value &root, bool retain_graph = true);
+
+    // propagate whatever grads were set on the recorded nodes beforehand, through every node on the tape, then clear it.
+    // For graphs with several outputs whose grads are known, e.g. a segment of a network (see checkpointed_forward_backward).
+    void backward();
+
+    // the tape new nodes are recorded on for this thread, or nullptr if not recording
+    static Tape *current();
+
+private:
+    std::vector<std::shared_ptr<Value>> nodes;
+};
+
+/**
+ * RAII guard that records every node created on this thread onto `tape` while alive. The tape is cleared when the
+ * scope ends, since its nodes are usually dropped along with the step's graph.
+ *
+ * Value::backward() uses the current tape automatically when its root was recorded on it, and falls back to
+ * the topological sort for graphs built outside a recording scope.
+ */
+class RecordingScope
+{
+public:
+    explicit RecordingScope(Tape &tape);
+    ~RecordingScope();
+    RecordingScope(const RecordingScope &) = delete;
+    RecordingScope &operator=(const RecordingScope &) = delete;
+
+private:
+    Tape &tape;
+    Tape *previous;
+};
@@ -0,0 +1,632 @@
+/**
+ * Tensor values and buffer-at-a-time operations for the batched layer path.
+ */
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include "tensor.h"
+#include "profiler.h"
+#include "simd.h"
+
+Tensor::Tensor(size_t rows, size_t cols, std::vector<float> data)
+    : n_rows(rows), n_cols(cols), data(std::move(data)), grad(rows * cols, 0.0f), data_ptr(this->data.data()), grad_ptr(grad.data())
+{
+    if (this->data.size() != rows * cols)
+    {
+        throw std::invalid_argument("Tensor data size " + std::to_string(this->data.size()) + " does not match shape " + std::to_string(rows) + "x" + std::to_string(cols));
+    }
+}
+
+Tensor::Tensor(size_t rows, size_t cols, std::span<float> data, std::span<float> grad)
+    : n_rows(rows), n_cols(cols), data_ptr(data.data()), grad_ptr(grad.data())
+{
+    if (data.size() != rows * cols || grad.size() != rows * cols)
+    {
+        throw std::invalid_argument("Tensor view of " + std::to_string(data.size()) + " values and " + std::to_string(grad.size()) + " grads does not match shape " + std::to_string(rows) + "x" + std::to_string(cols));
+    }
+}
+
+Tensor::Tensor(size_t rows, size_t cols, std::vector<float> data, const std::vector<std::shared_ptr<Tensor>> &prev, const std::shared_ptr<const TensorOperation> op)
+    : Tensor(rows, cols, std::move(data))
+{
+    this->prev = prev;
+    this->op = op;
+}
+
+void Tensor::set_sources(std::vector<std::shared_ptr<Value>> new_sources)
+{
+    if (new_sources.size() != data.size())
+    {
+        throw std::invalid_argument("Tensor sources size does not match tensor size");
+    }
+    sources = std::move(new_sources);
+}
+
+std::ostream &operator<<(std::ostream &os, const std::shared_ptr<Tensor> &t)
+{
+    os << "Tensor(" << t->rows() << "x" << t->cols() << ", operation = " << (t->get_operation() != nullptr ? t->get_operation()->get_name() : "nullopt") << ", data=[";
+    auto data = t->get_data();
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        os << data[i] << (i < data.size() - 1 ? ", " : "");
+    }
+    os << "])";
+    return os;
+}
+
+std::shared_ptr<Tensor> make_tensor(size_t rows, size_t cols, std::vector<float> data)
+{
+    return std::make_shared<Tensor>(rows, cols, std::move(data));
+}
+
+std::shared_ptr<Tensor> make_tensor_view(size_t rows, size_t cols, std::span<float> data, std::span<float> grad)
+{
+    return std::make_shared<Tensor>(rows, cols, data, grad);
+}
+
+// same in-degree based ordering as topo_sort for Values, but tensor graphs are only a handful of nodes per layer
+static std::vector<std::shared_ptr<Tensor>> topo_sort(const std::shared_ptr<Tensor> &out)
+{
+    std::unordered_map<std::shared_ptr<Tensor>, int> in_degree;
+    std::vector<std::shared_ptr<Tensor>> stack{out};
+    in_degree[out] = 0;
+    while (!stack.empty())
+    {
+        auto t = stack.back();
+        stack.pop_back();
+        for (const auto &p : t->get_prev())
+        {
+            if (!in_degree.count(p))
+            {
+                in_degree[p] = 0;
+                stack.push_back(p);
+            }
+            in_degree[p]++;
+        }
+    }
+
+    std::vector<std::shared_ptr<Tensor>> sorted{out};
+    sorted.reserve(in_degree.size());
+    for (size_t cur_index = 0; cur_index < sorted.size(); cur_index++)
+    {
+        for (const auto &p : sorted[cur_index]->get_prev())
+        {
+            if (--in_degree[p] == 0)
+            {
+                sorted.push_back(p);
+            }
+        }
+    }
+
+    if (sorted.size() != in_degree.size())
+    {
+        throw std::runtime_error("Cycle detected in tensor computation graph during topological sort");
+    }
+    return sorted;
+}
+
+void Tensor::backward()
+{
+    if (size() != 1)
+    {
+        throw std::runtime_error("backward() can only be called on a 1x1 tensor, got " + std::to_string(n_rows) + "x" + std::to_string(n_cols));
+    }
+
+    ProfileScope profile("backward", "phase");
+    auto sorted = topo_sort(shared_from_this());
+    profile.add_nodes(sorted.size());
+    grad_ptr[0] = 1.0f;
+
+    for (const auto &t : sorted)
+    {
+        if (t->op != nullptr)
+        {
+            t->op->backward(t->prev, t);
+        }
+        // packed leaves hand their grads back to the scalar Values they were gathered from
+        for (size_t i = 0; i < t->sources.size(); i++)
+        {
+            t->sources[i]->add_grad(t->grad_ptr[i]);
+        }
+    }
+}
+
+
+// Implementations of TensorOperation subclasses
+
+static void check_same_shape(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b, const std::string &op_name)
+{
+    if (a->rows() != b->rows() || a->cols() != b->cols())
+    {
+        throw std::runtime_error(op_name + " operation requires tensors of the same shape, got " + std::to_string(a->rows()) + "x" + std::to_string(a->cols()) + " and " + std::to_string(b->rows()) + "x" + std::to_string(b->cols()));
+    }
+}
+
+std::shared_ptr<Tensor> MatMul::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("MatMul operation requires exactly two inputs");
+    }
+    const auto &a = inputs[0];
+    const auto &b = inputs[1];
+    if (a->cols() != b->rows())
+    {
+        throw std::runtime_error("MatMul shape mismatch: " + std::to_string(a->rows()) + "x" + std::to_string(a->cols()) + " @ " + std::to_string(b->rows()) + "x" + std::to_string(b->cols()));
+    }
+    size_t n = a->rows(), k_dim = a->cols(), m = b->cols();
+    std::vector<float> result(n * m, 0.0f);
+    auto A = a->get_data();
+    auto B = b->get_data();
+
+    // i-k-j order so the innermost loop streams contiguously through a row of B and a row of the result
+    for (size_t i = 0; i < n; i++)
+    {
+        float *out_row = result.data() + i * m;
+        for (size_t k = 0; k < k_dim; k++)
+        {
+            simd::axpy(A[i * k_dim + k], B.data() + k * m, out_row, m);
+        }
+    }
+    return std::make_shared<Tensor>(n, m, std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void MatMul::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("MatMul operation requires exactly two inputs");
+    }
+    const auto &a = inputs[0];
+    const auto &b = inputs[1];
+    size_t n = a->rows(), k_dim = a->cols(), m = b->cols();
+    auto A = a->get_data();
+    auto B = b->get_data();
+    auto dA = a->get_grad();
+    auto dB = b->get_grad();
+    auto dC = out->get_grad();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const float *dc_row = dC.data() + i * m;
+        for (size_t k = 0; k < k_dim; k++)
+        {
+            // dA = dC @ B^T: row i of dC dotted with row k of B
+            dA[i * k_dim + k] += simd::dot(dc_row, B.data() + k * m, m);
+
+            // dB = A^T @ dC: row k of dB accumulates A[i][k] * row i of dC
+            simd::axpy(A[i * k_dim + k], dc_row, dB.data() + k * m, m);
+        }
+    }
+}
+
+std::string MatMul::get_name() const
+{
+    return "matmul";
+}
+
+
+std::shared_ptr<Tensor> Dense::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("Dense operation requires exactly two inputs");
+    }
+    const auto &x = inputs[0];
+    const auto &parameters = inputs[1];
+    if (parameters->cols() != x->cols() + 1)
+    {
+        throw std::runtime_error("Dense requires " + std::to_string(x->cols() + 1) + " parameters per neuron (weights and bias), got " + std::to_string(parameters->rows()) + "x" + std::to_string(parameters->cols()));
+    }
+    size_t n = x->rows(), k_dim = x->cols(), m = parameters->rows();
+    std::vector<float> result(n * m);
+    auto X = x->get_data();
+    auto P = parameters->get_data();
+
+    // each neuron's weights are contiguous, so every output is one dot product over a row of x
+    for (size_t i = 0; i < n; i++)
+    {
+        const float *x_row = X.data() + i * k_dim;
+        for (size_t j = 0; j < m; j++)
+        {
+            const float *p = P.data() + j * (k_dim + 1);
+            result[i * m + j] = simd::dot(p, x_row, k_dim) + p[k_dim];
+        }
+    }
+    return std::make_shared<Tensor>(n, m, std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void Dense::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("Dense operation requires exactly two inputs");
+    }
+    const auto &x = inputs[0];
+    const auto &parameters = inputs[1];
+    size_t n = x->rows(), k_dim = x->cols(), m = parameters->rows();
+    auto X = x->get_data();
+    auto P = parameters->get_data();
+    auto dX = x->get_grad();
+    auto dP = parameters->get_grad();
+    auto dC = out->get_grad();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const float *x_row = X.data() + i * k_dim;
+        float *dx_row = dX.data() + i * k_dim;
+        for (size_t j = 0; j < m; j++)
+        {
+            float d = dC[i * m + j];
+            const float *p = P.data() + j * (k_dim + 1);
+            float *dp = dP.data() + j * (k_dim + 1);
+            // d(out)/d(w_j) = x_i and d(out)/d(b_j) = 1, summed over the rows of the batch
+            simd::axpy(d, x_row, dp, k_dim);
+            dp[k_dim] += d;
+            // d(out)/d(x_i) = w_j
+            simd::axpy(d, p, dx_row, k_dim);
+        }
+    }
+}
+
+std::string Dense::get_name() const
+{
+    return "dense";
+}
+
+
+std::shared_ptr<Tensor> AddBias::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("AddBias operation requires exactly two inputs");
+    }
+    const auto &x = inputs[0];
+    const auto &bias = inputs[1];
+    if (bias->rows() != 1 || bias->cols() != x->cols())
+    {
+        throw std::runtime_error("AddBias requires a 1x" + std::to_string(x->cols()) + " bias, got " + std::to_string(bias->rows()) + "x" + std::to_string(bias->cols()));
+    }
+    size_t n = x->rows(), m = x->cols();
+    std::vector<float> result(x->get_data().begin(), x->get_data().end());
+    auto b = bias->get_data();
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t j = 0; j < m; j++)
+        {
+            result[i * m + j] += b[j];
+        }
+    }
+    return std::make_shared<Tensor>(n, m, std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void AddBias::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("AddBias operation requires exactly two inputs");
+    }
+    size_t n = out->rows(), m = out->cols();
+    auto dx = inputs[0]->get_grad();
+    auto db = inputs[1]->get_grad();
+    auto d_out = out->get_grad();
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t j = 0; j < m; j++)
+        {
+            dx[i * m + j] += d_out[i * m + j];
+            db[j] += d_out[i * m + j]; // the bias is reused by every row, so its grads add up
+        }
+    }
+}
+
+std::string AddBias::get_name() const
+{
+    return "+bias";
+}
+
+
+std::shared_ptr<Tensor> ElementwiseAdd::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("ElementwiseAdd operation requires exactly two inputs");
+    }
+    check_same_shape(inputs[0], inputs[1], "ElementwiseAdd");
+    auto a = inputs[0]->get_data();
+    auto b = inputs[1]->get_data();
+    std::vector<float> result(a.size());
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        result[i] = a[i] + b[i];
+    }
+    return std::make_shared<Tensor>(inputs[0]->rows(), inputs[0]->cols(), std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void ElementwiseAdd::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("ElementwiseAdd operation requires exactly two inputs");
+    }
+    auto d_out = out->get_grad();
+    auto da = inputs[0]->get_grad();
+    auto db = inputs[1]->get_grad();
+    for (size_t i = 0; i < d_out.size(); i++)
+    {
+        da[i] += d_out[i];
+        db[i] += d_out[i];
+    }
+}
+
+std::string ElementwiseAdd::get_name() const
+{
+    return "+";
+}
+
+
+std::shared_ptr<Tensor> ElementwiseSubtract::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("ElementwiseSubtract operation requires exactly two inputs");
+    }
+    check_same_shape(inputs[0], inputs[1], "ElementwiseSubtract");
+    auto a = inputs[0]->get_data();
+    auto b = inputs[1]->get_data();
+    std::vector<float> result(a.size());
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        result[i] = a[i] - b[i];
+    }
+    return std::make_shared<Tensor>(inputs[0]->rows(), inputs[0]->cols(), std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void ElementwiseSubtract::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("ElementwiseSubtract operation requires exactly two inputs");
+    }
+    auto d_out = out->get_grad();
+    auto da = inputs[0]->get_grad();
+    auto db = inputs[1]->get_grad();
+    for (size_t i = 0; i < d_out.size(); i++)
+    {
+        da[i] += d_out[i];
+        db[i] -= d_out[i];
+    }
+}
+
+std::string ElementwiseSubtract::get_name() const
+{
+    return "-";
+}
+
+
+std::shared_ptr<Tensor> ElementwiseMultiply::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("ElementwiseMultiply operation requires exactly two inputs");
+    }
+    check_same_shape(inputs[0], inputs[1], "ElementwiseMultiply");
+    auto a = inputs[0]->get_data();
+    auto b = inputs[1]->get_data();
+    std::vector<float> result(a.size());
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        result[i] = a[i] * b[i];
+    }
+    return std::make_shared<Tensor>(inputs[0]->rows(), inputs[0]->cols(), std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void ElementwiseMultiply::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 2)
+    {
+        throw std::runtime_error("ElementwiseMultiply operation requires exactly two inputs");
+    }
+    auto d_out = out->get_grad();
+    auto a = inputs[0]->get_data();
+    auto b = inputs[1]->get_data();
+    auto da = inputs[0]->get_grad();
+    auto db = inputs[1]->get_grad();
+    // product rule, per element
+    for (size_t i = 0; i < d_out.size(); i++)
+    {
+        da[i] += b[i] * d_out[i];
+        db[i] += a[i] * d_out[i];
+    }
+}
+
+std::string ElementwiseMultiply::get_name() const
+{
+    return "*";
+}
+
+
+std::shared_ptr<Tensor> ElementwiseTanh::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 1)
+    {
+        throw std::runtime_error("ElementwiseTanh operation requires exactly one input");
+    }
+    auto x = inputs[0]->get_data();
+    std::vector<float> result(x.size());
+    simd::tanh(x.data(), result.data(), result.size());
+    return std::make_shared<Tensor>(inputs[0]->rows(), inputs[0]->cols(), std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void ElementwiseTanh::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 1)
+    {
+        throw std::runtime_error("ElementwiseTanh operation requires exactly one input");
+    }
+    auto d_out = out->get_grad();
+    auto t = out->get_data(); // tanh(x)
+    auto dx = inputs[0]->get_grad();
+    for (size_t i = 0; i < d_out.size(); i++)
+    {
+        dx[i] += (1.0f - t[i] * t[i]) * d_out[i];
+    }
+}
+
+std::string ElementwiseTanh::get_name() const
+{
+    return "tanh";
+}
+
+
+std::shared_ptr<Tensor> Sum::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 1)
+    {
+        throw std::runtime_error("Sum operation requires exactly one input");
+    }
+    float total = 0.0f;
+    for (float x : inputs[0]->get_data())
+    {
+        total += x;
+    }
+    return std::make_shared<Tensor>(1, 1, std::vector<float>{total}, std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void Sum::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 1)
+    {
+        throw std::runtime_error("Sum operation requires exactly one input");
+    }
+    float d_out = out->get_grad()[0];
+    for (float &g : inputs[0]->get_grad())
+    {
+        g += d_out;
+    }
+}
+
+std::string Sum::get_name() const
+{
+    return "sum";
+}
+
+
+std::shared_ptr<Tensor> ElementwiseActivation::forward(std::span<const std::shared_ptr<Tensor>> inputs) const
+{
+    if (inputs.size() != 1)
+    {
+        throw std::runtime_error("ElementwiseActivation operation requires exactly one input");
+    }
+    auto x = inputs[0]->get_data();
+    std::vector<float> result(x.size());
+    ::activate(activation, x.data(), result.data(), result.size());
+    return std::make_shared<Tensor>(inputs[0]->rows(), inputs[0]->cols(), std::move(result), std::vector<std::shared_ptr<Tensor>>(inputs.begin(), inputs.end()), shared_from_this());
+}
+
+void ElementwiseActivation::backward(std::span<const std::shared_ptr<Tensor>> inputs, std::shared_ptr<const Tensor> out) const
+{
+    if (inputs.size() != 1)
+    {
+        throw std::runtime_error("ElementwiseActivation operation requires exactly one input");
+    }
+    auto d_out = out->get_grad();
+    auto y = out->get_data();
+    auto dx = inputs[0]->get_grad();
+    for (size_t i = 0; i < d_out.size(); i++)
+    {
+        dx[i] += activation_derivative(activation, y[i]) * d_out[i];
+    }
+}
+
+std::string ElementwiseActivation::get_name() const
+{
+    return activation_name(activation);
+}
+
+
+namespace operation {
+
+std::shared_ptr<Tensor> matmul(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b)
+{
+    static auto matmul_op = std::make_shared<MatMul>();
+    std::array<std::shared_ptr<Tensor>, 2> inputs{a, b};
+    return matmul_op->forward(inputs);
+}
+
+std::shared_ptr<Tensor> add_bias(const std::shared_ptr<Tensor> &x, const std::shared_ptr<Tensor> &bias)
+{
+    static auto add_bias_op = std::make_shared<AddBias>();
+    std::array<std::shared_ptr<Tensor>, 2> inputs{x, bias};
+    return add_bias_op->forward(inputs);
+}
+
+std::shared_ptr<Tensor> dense(const std::shared_ptr<Tensor> &x, const std::shared_ptr<Tensor> &parameters)
+{
+    static auto dense_op = std::make_shared<Dense>();
+    std::array<std::shared_ptr<Tensor>, 2> inputs{x, parameters};
+    return dense_op->forward(inputs);
+}
+
+std::shared_ptr<Tensor> operator+(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b)
+{
+    static auto add = std::make_shared<ElementwiseAdd>();
+    std::array<std::shared_ptr<Tensor>, 2> inputs{a, b};
+    return add->forward(inputs);
+}
+
+std::shared_ptr<Tensor> operator-(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b)
+{
+    static auto subtract = std::make_shared<ElementwiseSubtract>();
+    std::array<std::shared_ptr<Tensor>, 2> inputs{a, b};
+    return subtract->forward(inputs);
+}
+
+std::shared_ptr<Tensor> operator*(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b)
+{
+    static auto multiply = std::make_shared<ElementwiseMultiply>();
+    std::array<std::shared_ptr<Tensor>, 2> inputs{a, b};
+    return multiply->forward(inputs);
+}
+
+std::shared_ptr<Tensor> tanh(const std::shared_ptr<Tensor> &x)
+{
+    static auto tanh_op = std::make_shared<ElementwiseTanh>();
+    std::array<std::shared_ptr<Tensor>, 1> inputs{x};
+    return tanh_op->forward(inputs);
+}
+
+std::shared_ptr<Tensor> activate(const std::shared_ptr<Tensor> &x, Activation activation)
+{
+    static const std::array<std::shared_ptr<ElementwiseActivation>, 3> activation_ops{
+        std::make_shared<ElementwiseActivation>(Activation::Tanh),
+        std::make_shared<ElementwiseActivation>(Activation::Sigmoid),
+        std::make_shared<ElementwiseActivation>(Activation::ReLU),
+    };
+    std::array<std::shared_ptr<Tensor>, 1> inputs{x};
+    return activation_ops[static_cast<size_t>(activation)]->forward(inputs);
+}
+
+std::shared_ptr<Tensor> sum(const std::shared_ptr<Tensor> &x)
+{
+    static auto sum_op = std::make_shared<Sum>();
+    std::array<std::shared_ptr<Tensor>, 1> inputs{x};
+    return sum_op->forward(inputs);
+}
+
+std::shared_ptr<Tensor> pack(std::span<const std::shared_ptr<Value>> values, size_t rows, size_t cols)
+{
+    std::vector<float> data;
+    data.reserve(values.size());
+    for (const auto &v : values)
+    {
+        data.push_back(v->get_data());
+    }
+    auto out = make_tensor(rows, cols, std::move(data));
+    out->set_sources(std::vector<std::shared_ptr<Value>>(values.begin(), values.end()));
+    return out;
+}
+
+}
@@ -0,0 +1,147 @@
+/**
+ * Tensor-valued counterpart of Value, so that a whole layer can be one node in the computation graph instead of
+ * one node per multiply/add.
+ */
+#pragma once
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "autograd.h"
+
+class TensorOperation;
+
+/**
+ * A Tensor is a row-major 2D buffer of floats (rows x cols), along with a gradient buffer of the same shape and its
+ * dependencies in the computation graph. It plays the same role as Value, but every operation works on whole buffers.
+ *
+ * For batched layers, rows index the samples in the batch and cols index the features.
+ *
+ * A Tensor can also be "packed" from scalar Values (see operation::pack), in which case backward() pushes its gradient
+ * back into those Values, so existing parameters and the Optimizer keep working with the tensor path.
+ *
+ * Or it can be a view of buffers it doesn't own (see make_tensor_view), e.g. a layer's slice of a ParameterStore: the
+ * parameters are read in place, and backward accumulates straight into their grads, without gathering or scattering.
+ */
+class Tensor : public std::enable_shared_from_this<Tensor>
+{
+public:
+    Tensor(size_t rows, size_t cols, std::vector<float> data);
+    Tensor(size_t rows, size_t cols, std::vector<float> data, const std::vector<std::shared_ptr<Tensor>> &prev, const std::shared_ptr<const TensorOperation> op);
+    // a leaf over external buffers of rows * cols floats each, which must outlive the tensor
+    Tensor(size_t rows, size_t cols, std::span<float> data, std::span<float> grad);
+
+    // data_ptr/grad_ptr may point into the tensor's own buffers
+    Tensor(const Tensor &) = delete;
+    Tensor &operator=(const Tensor &) = delete;
+
+    size_t rows() const { return n_rows; }
+    size_t cols() const { return n_cols; }
+    size_t size() const { return n_rows * n_cols; }
+
+    std::span<float> get_data() { return {data_ptr, size()}; }
+    std::span<const float> get_data() const { return {data_ptr, size()}; }
+    std::span<float> get_grad() { return {grad_ptr, size()}; }
+    std::span<const float> get_grad() const { return {grad_ptr, size()}; }
+
+    float at(size_t row, size_t col) const { return data_ptr[row * n_cols + col]; }
+
+    const std::vector<std::shared_ptr<Tensor>> &get_prev() const { return prev; }
+    const std::shared_ptr<const TensorOperation> &get_operation() const { return op; }
+
+    // scalar Values this tensor was packed from (empty unless created by operation::pack)
+    const std::vector<std::shared_ptr<Value>> &get_sources() const { return sources; }
+    void set_sources(std::vector<std::shared_ptr<Value>> new_sources);
+
+    // propagate gradients through all dependent tensors, same semantics as Value::backward. Only valid on a 1x1 tensor (e.g. a loss).
+    void backward();
+
+private:
+    size_t n_rows;
+    size_t n_cols;
+    std::vector<float> data; // row-major, rows * cols elements (empty for a view)
+    std::vector<float> grad; // same shape as data
+    float *data_ptr;         // data.data(), or the viewed buffer
+    float *grad_ptr;         // same for grad
+
+    std::vector<std::shared_ptr<Tensor>> prev;
+    std::shared_ptr<const TensorOperation> op = nullptr;
+    std::vector<std::shared_ptr<Value>> sources;
+};
+
+class TensorOperation : public std::enable_shared_from_this<TensorOperation>
+{
+    /**
+     * Same contract as Operation, but on tensors: forward builds the output tensor, and backward accumulates grads into the
+     * inputs from the grad of the output, one buffer at a time.
+     */
+public:
+    virtual ~TensorOperation() = default;
+
+    virtual std::shared_ptr<Tensor> forward(std::span<std::shared_ptr<Tensor> const> inputs) const = 0;
+
+    virtual void backward(std::span<std::shared_ptr<Tensor> const> inputs, std::shared_ptr<const Tensor> out) const = 0;
+
+    virtual std::string get_name() const = 0;
+};
+
+#define DECLARE_TENSOR_OPERATION_CLASS(OP_NAME) \
+ class OP_NAME : public TensorOperation { \
+     public: \
+         std::shared_ptr<Tensor> forward(std::span<std::shared_ptr<Tensor> const> inputs) const override; \
+  \
+         void backward(std::span<std::shared_ptr<Tensor> const> inputs, std::shared_ptr<const Tensor> out) const override; \
+  \
+         std::string get_name() const override; \
+ };
+DECLARE_TENSOR_OPERATION_CLASS(MatMul)              // [n x k] @ [k x m] -> [n x m]
+DECLARE_TENSOR_OPERATION_CLASS(AddBias)             // [n x m] + [1 x m], bias broadcast over rows
+// [n x k] with [m x (k + 1)] parameters, each row holding a neuron's k weights then its bias (the layout of a layer in a
+// ParameterStore) -> [n x m], out[i][j] = dot(x_i, w_j) + b_j
+DECLARE_TENSOR_OPERATION_CLASS(Dense)
+DECLARE_TENSOR_OPERATION_CLASS(ElementwiseAdd)
+DECLARE_TENSOR_OPERATION_CLASS(ElementwiseSubtract)
+DECLARE_TENSOR_OPERATION_CLASS(ElementwiseMultiply)
+DECLARE_TENSOR_OPERATION_CLASS(ElementwiseTanh)
+DECLARE_TENSOR_OPERATION_CLASS(Sum)                 // sum of all elements -> [1 x 1]
+
+// any Activation applied elementwise, so each layer of the tensor path can pick its own
+class ElementwiseActivation : public TensorOperation {
+    public:
+        explicit ElementwiseActivation(Activation activation) : activation(activation) {}
+
+        std::shared_ptr<Tensor> forward(std::span<std::shared_ptr<Tensor> const> inputs) const override;
+
+        void backward(std::span<std::shared_ptr<Tensor> const> inputs, std::shared_ptr<const Tensor> out) const override;
+
+        std::string get_name() const override;
+    private:
+        Activation activation;
+};
+
+std::ostream &operator<<(std::ostream &os, const std::shared_ptr<Tensor> &t);
+
+std::shared_ptr<Tensor> make_tensor(size_t rows, size_t cols, std::vector<float> data);
+// a leaf tensor reading and accumulating into buffers it doesn't own, see Tensor
+std::shared_ptr<Tensor> make_tensor_view(size_t rows, size_t cols, std::span<float> data, std::span<float> grad);
+
+namespace operation {
+/**
+ * public facing APIs for tensor operations, mirroring the scalar ones.
+ */
+std::shared_ptr<Tensor> matmul(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b);
+std::shared_ptr<Tensor> add_bias(const std::shared_ptr<Tensor> &x, const std::shared_ptr<Tensor> &bias);
+std::shared_ptr<Tensor> dense(const std::shared_ptr<Tensor> &x, const std::shared_ptr<Tensor> &parameters); // see Dense
+std::shared_ptr<Tensor> operator+(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b);
+std::shared_ptr<Tensor> operator-(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b);
+std::shared_ptr<Tensor> operator*(const std::shared_ptr<Tensor> &a, const std::shared_ptr<Tensor> &b); // elementwise, not matmul
+std::shared_ptr<Tensor> tanh(const std::shared_ptr<Tensor> &x);
+std::shared_ptr<Tensor> activate(const std::shared_ptr<Tensor> &x, Activation activation);
+std::shared_ptr<Tensor> sum(const std::shared_ptr<Tensor> &x);
+
+/**
+ * Gather scalar Values into a rows x cols tensor (row-major). This is a copy of the data, but the tensor remembers the
+ * Values it came from, so gradients computed on the tensor flow back into them during backward.
+ */
+std::shared_ptr<Tensor> pack(std::span<const std::shared_ptr<Value>> values, size_t rows, size_t cols);
+}
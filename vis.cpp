@@ -10,9 +10,8 @@
  *  - Does NOT require any third-party library. DOT is plain text.
  *******************************/
 
-#include <unordered_map>
-#include <unordered_set>
 #include <sstream>
+#include <vector>
 #include <fstream>
 #include "vis.h"
 
@@ -24,20 +23,20 @@
  *   data=...
  *   op=... (or none)
  */
-std::string value_label(const std::shared_ptr<Value>& v) {
+std::string value_label(const Value& v) {
     std::ostringstream ss;
 
-    if (v->get_label().has_value()) {
-        ss << v->get_label().value();
-        ss << "\\ndata=" << v->get_data();
+    if (auto label = v.get_label()) {
+        ss << *label;
+        ss << "\\ndata=" << v.get_data();
     } else {
-        ss << "data=" << v->get_data();
+        ss << "data=" << v.get_data();
     }
 
-    ss << "\\ngrad=" << v->get_grad();
+    ss << "\\ngrad=" << v.get_grad();
 
-    if (v->get_operation() != nullptr) {
-        ss << "\\nop=" << v->get_operation()->get_name();
+    if (v.get_operation() != nullptr) {
+        ss << "\\nop=" << v.get_operation()->get_name();
     }
     return ss.str();
 }
@@ -61,40 +60,44 @@ std::string to_dot(const std::shared_ptr<Value>& out) {
     os << "  rankdir=LR;\n";
     os << "  node [shape=box];\n";
 
-    // Assign stable numeric IDs per node pointer
-    std::unordered_map<const Value*, int> ids;
-    std::unordered_set<const Value*> seen; // make sure we only emit each node once
-    int next_id = 0;
-
-    std::function<void(const std::shared_ptr<Value>&)> dfs =
-        [&](const std::shared_ptr<Value>& v) {
-            if (!v) return;
-
-            const Value* ptr = v.get();
-            if (!ids.count(ptr)) ids[ptr] = next_id++;
-
-            // emit node once
-            if (!seen.count(ptr)) {
-                seen.insert(ptr);
-                os << "  n" << ids[ptr]
-                   << " [label=\"" << value_label(v) << "\"];\n";
-            }
-
-            // add edges: prev -> current
-            for (const auto& p : v->get_prev()) {
-                if (!p) continue;
-
-                const Value* pptr = p.get();
-                if (!ids.count(pptr)) ids[pptr] = next_id++;
-
-                os << "  n" << ids[pptr] << " -> n" << ids[ptr] << ";\n";
-
-                // continue traversal
-                if (!seen.count(pptr)) dfs(p);
-            }
-        };
+    // depth-first with an explicit stack, so deep graphs don't overflow the call stack. Each node's id lives in its
+    // traversal counter, and being stamped with this traversal's epoch means it was already emitted.
+    uint64_t epoch = new_traversal_epoch();
+    uint32_t next_id = 0;
+    struct Frame {
+        Value* v;
+        size_t next_operand;
+    };
+    std::vector<Frame> stack;
+
+    auto emit_node = [&](Value* v) {
+        os << "  n" << v->traversal_counter()
+           << " [label=\"" << value_label(*v) << "\"];\n";
+        stack.push_back({v, 0});
+    };
+    if (out) {
+        out->mark_visited(epoch);
+        out->traversal_counter() = next_id++;
+        emit_node(out.get());
+    }
 
-    dfs(out);
+    while (!stack.empty()) {
+        Frame& frame = stack.back();
+        const auto& prev = frame.v->get_prev();
+        if (frame.next_operand == prev.size()) {
+            stack.pop_back();
+            continue;
+        }
+        Value* v = frame.v;
+        Value* p = prev[frame.next_operand++].get();
+        if (p == nullptr) continue;
+
+        // add edges: prev -> current, then continue the traversal into prev if it is new
+        bool is_new = p->mark_visited(epoch);
+        if (is_new) p->traversal_counter() = next_id++;
+        os << "  n" << p->traversal_counter() << " -> n" << v->traversal_counter() << ";\n";
+        if (is_new) emit_node(p);
+    }
 
     os << "}\n";
     return os.str();